@@ -0,0 +1,69 @@
+/*
+ * mm-policy.cc - C wrapper of one mm::heap instantiation (mm-policy.hpp)
+ *
+ * Exports the names of the DRIVER build (mm_init, mm_malloc, mm_free,
+ * mm_realloc, mm_calloc, mm_checkheap), so that the driver and mmbench
+ * run it like the other packages. The policies are set at compile time:
+ *   -DMM_FIT=best_fit        first_fit, best_fit or next_fit
+ *   -DMM_CLASSES=tlsf_classes<>   tlsf_classes<SL_LOG2, FL_MAX_LOG2>,
+ *                            pow2_classes<MAX_LOG2> or single_class
+ *   -DMM_COALESCE=immediate  immediate or deferred
+ *   -DMM_ALIGN=8             8 or 16
+ * e.g. g++ -O2 -DDRIVER -DMM_FIT=next_fit -DMM_CLASSES=single_class ...
+ */
+#include "mm-policy.hpp"
+
+/* The package is always called through the DRIVER names */
+#ifndef DRIVER
+#define DRIVER
+#endif
+extern "C" {
+#include "mm.h"
+}
+
+#ifndef MM_FIT
+#define MM_FIT best_fit
+#endif
+#ifndef MM_CLASSES
+#define MM_CLASSES tlsf_classes<>
+#endif
+#ifndef MM_COALESCE
+#define MM_COALESCE immediate
+#endif
+#ifndef MM_ALIGN
+#define MM_ALIGN 8
+#endif
+
+typedef mm::heap<mm::MM_FIT, mm::MM_CLASSES, mm::MM_COALESCE, MM_ALIGN> heap_t;
+
+static heap_t heap;
+
+extern "C" int mm_init(void) {
+    heap = heap_t();
+    return heap.init();
+}
+
+extern "C" void *mm_malloc(size_t size) {
+    return heap.malloc(size);
+}
+
+extern "C" void mm_free(void *ptr) {
+    heap.free(ptr);
+}
+
+extern "C" void *mm_realloc(void *ptr, size_t size) {
+    return heap.realloc(ptr, size);
+}
+
+extern "C" void *mm_calloc(size_t nmemb, size_t size) {
+    return heap.calloc(nmemb, size);
+}
+
+/*
+ * mm_checkheap - Print the first violation and their number, if any
+ */
+extern "C" void mm_checkheap(int lineno) {
+    int errors = heap.check(true);
+    if (errors != 0)
+        fprintf(stderr, "checkheap(%d): %d violations\n", lineno, errors);
+}
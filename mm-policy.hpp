@@ -0,0 +1,608 @@
+/*
+ * mm-policy.hpp - Header-only, policy based heap core for C++ users
+ *
+ * mm::heap is the free list heap of mm.c as a class template. Blocks have
+ * a 4-byte header with the size, the allocated bit and the prev allocated
+ * bit; only free blocks have a footer and two 8-byte links, and free
+ * blocks are kept on segregated lists with a bitmap of non-empty classes.
+ * mm.c selects its policies with -D flags; here template arguments pick
+ * them, so every choice is resolved at compile time and there is no
+ * runtime dispatch:
+ *
+ *  Fit       best_fit     lists are sorted by size, the first block of the
+ *                         class that fits is its best fit (mm.c's default)
+ *            first_fit    lists are LIFO, the first block that fits is taken
+ *            next_fit     lists are LIFO, the search of a class resumes
+ *                         after the block it took last time
+ *  Classes   tlsf_classes<SL_LOG2, FL_MAX_LOG2>  mm.c's two-level table
+ *            pow2_classes<MAX_LOG2>              one class per power of two
+ *            single_class                        one list for all sizes
+ *  Coalesce  immediate    free merges a block with its free neighbours
+ *            deferred     free only lists the block; neighbours are merged
+ *                         in one pass over the heap when no block fits
+ *  Align     8 or 16
+ *  Source    memlib_source   the memlib heap, through mem_sbrk
+ *            region_source   a region of the heap's own, reserved with mmap
+ *
+ * With the defaults, find_fit, place, coalesce and the list operations
+ * do what they do in mm.c built with -DNO_SLABS, and the heap grows the
+ * same way (by the shortfall if the last block is free, else by 1/32 of
+ * the heap within [4 KiB, 1 MiB]). Slabs, the tcache, arenas, mapped
+ * blocks and trimming stay in mm.c. All heaps over memlib_source share the
+ * memlib heap, so only one of them may be used; each heap over a
+ * region_source has its own, and release drops all of its blocks at once
+ * (mm-resource.hpp builds memory resources on that). mm-policy.cc wraps one
+ * instantiation with the mm_malloc/mm_free names of the DRIVER build.
+ */
+#ifndef MM_POLICY_HPP
+#define MM_POLICY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <sys/mman.h>
+
+extern "C" {
+#include "memlib.h"
+}
+
+namespace mm {
+
+/* Block format, as the macros of mm.c */
+namespace block {
+
+constexpr std::size_t WSIZE = 4;  /* Header/footer size (bytes) */
+constexpr std::size_t DSIZE = 8;  /* Link size (bytes) */
+
+inline std::uint32_t& hdr(void *bp) {
+    return *reinterpret_cast<std::uint32_t*>(static_cast<char*>(bp) - WSIZE);
+}
+inline std::size_t size(void *bp) { return hdr(bp) & ~7u; }
+inline bool alloc(void *bp) { return hdr(bp) & 1; }
+inline bool prev_alloc(void *bp) { return hdr(bp) & 2; }
+inline std::uint32_t& ftr(void *bp) {
+    return *reinterpret_cast<std::uint32_t*>(static_cast<char*>(bp) + size(bp) - DSIZE);
+}
+inline void* next_blk(void *bp) { return static_cast<char*>(bp) + size(bp); }
+inline void* prev_blk(void *bp) {
+    char *p = static_cast<char*>(bp);
+    return p - (*reinterpret_cast<std::uint32_t*>(p - DSIZE) & ~7u);
+}
+
+/* Free list links of free block bp */
+inline void*& prev(void *bp) { return static_cast<void**>(bp)[0]; }
+inline void*& next(void *bp) { return static_cast<void**>(bp)[1]; }
+
+} // namespace block
+
+/* Size classes: count classes, index(size) in [0, count). A block of a
+   larger class always fits a request of a smaller one */
+
+/* mm.c's table: sizes < 2^(SL_LOG2+3) in 8 byte steps, then 2^SL_LOG2
+   subclasses per power of two, sizes >= 2^FL_MAX_LOG2 share the last class */
+template <int SL_LOG2 = 2, int FL_MAX_LOG2 = 20>
+struct tlsf_classes {
+    static_assert(SL_LOG2 >= 0 && SL_LOG2 <= 5, "SL_LOG2 must be in 0..5");
+    static constexpr int FL_MIN_LOG2 = SL_LOG2 + 3;
+    static_assert(FL_MAX_LOG2 > FL_MIN_LOG2, "FL_MAX_LOG2 out of range");
+    static constexpr int count = ((FL_MAX_LOG2 - FL_MIN_LOG2 + 1) << SL_LOG2) + 1;
+
+    static int index(std::size_t size) {
+        if (size >= (std::size_t(1) << FL_MAX_LOG2))
+            return count - 1;
+        if (size < (std::size_t(1) << FL_MIN_LOG2))
+            return int(size >> 3);
+        int fl = int(8 * sizeof(std::size_t)) - 1 - __builtin_clzl(size);
+        int sl = int(size >> (fl - SL_LOG2)) - (1 << SL_LOG2);
+        return ((fl - FL_MIN_LOG2 + 1) << SL_LOG2) + sl;
+    }
+};
+
+/* One class per power of two from 16 bytes, sizes >= 2^MAX_LOG2 share the last */
+template <int MAX_LOG2 = 20>
+struct pow2_classes {
+    static_assert(MAX_LOG2 > 4, "MAX_LOG2 out of range");
+    static constexpr int count = MAX_LOG2 - 3;
+
+    static int index(std::size_t size) {
+        int fl = int(8 * sizeof(std::size_t)) - 1 - __builtin_clzl(size);
+        return fl >= MAX_LOG2 ? count - 1 : fl - 4;
+    }
+};
+
+/* A single list */
+struct single_class {
+    static constexpr int count = 1;
+    static int index(std::size_t) { return 0; }
+};
+
+/* Fit policies: state<N> lives in the heap, find searches the list of
+   class c for asize bytes, removed is told of a block leaving list c */
+
+struct first_fit {
+    static constexpr bool sorted = false;
+
+    template <int N>
+    struct state {
+        void* find(void *head, int, std::size_t asize) {
+            for (void *bp = head; bp != nullptr; bp = block::next(bp))
+                if (block::size(bp) >= asize)
+                    return bp;
+            return nullptr;
+        }
+        void removed(int, void*) {}
+        void reset() {}
+    };
+};
+
+/* First fit of a sorted list is its best fit */
+struct best_fit {
+    static constexpr bool sorted = true;
+
+    template <int N>
+    struct state : first_fit::state<N> {};
+};
+
+struct next_fit {
+    static constexpr bool sorted = false;
+
+    template <int N>
+    struct state {
+        void *rover[N] = {};   /* Where the next search of a class starts */
+
+        void* find(void *head, int c, std::size_t asize) {
+            void *start = rover[c] != nullptr ? rover[c] : head;
+            void *bp;
+            for (bp = start; bp != nullptr; bp = block::next(bp))
+                if (block::size(bp) >= asize)
+                    return rover[c] = bp;
+            for (bp = head; bp != start; bp = block::next(bp))
+                if (block::size(bp) >= asize)
+                    return rover[c] = bp;
+            return nullptr;
+        }
+        // The rover moves on past a block leaving its list
+        void removed(int c, void *bp) {
+            if (rover[c] == bp)
+                rover[c] = block::next(bp);
+        }
+        void reset() { std::memset(rover, 0, sizeof(rover)); }
+    };
+};
+
+/* Coalescing policies */
+struct immediate { static constexpr bool on_free = true; };
+struct deferred  { static constexpr bool on_free = false; };
+
+/* Memory sources: sbrk(incr) moves the end of the heap up by incr bytes
+   and returns the old end, or (void*) -1; end() is the current end and
+   reset() takes it back to where it started */
+
+struct memlib_source {
+    void* sbrk(std::size_t incr) { return mem_sbrk(int(incr)); }
+    char* end() const { return static_cast<char*>(mem_heap_hi()) + 1; }
+    void reset() { mem_reset_brk(); }
+};
+
+/* reserve bytes of address space mapped on construction (the pages are
+   only faulted in as the heap reaches them) and unmapped on destruction */
+class region_source {
+public:
+    static constexpr std::size_t DEFAULT_RESERVE = std::size_t(1) << 30;
+
+    explicit region_source(std::size_t reserve = DEFAULT_RESERVE) {
+        reserve = (reserve + 4095) & ~std::size_t(4095);
+        void *p = mmap(nullptr, reserve, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        base_ = brk_ = static_cast<char*>(p);
+        limit_ = base_ + reserve;
+    }
+    region_source(region_source &&o) noexcept
+        : base_(std::exchange(o.base_, nullptr)), brk_(o.brk_), limit_(o.limit_) {}
+    region_source& operator=(region_source &&o) noexcept {
+        std::swap(base_, o.base_);
+        std::swap(brk_, o.brk_);
+        std::swap(limit_, o.limit_);
+        return *this;
+    }
+    ~region_source() {
+        if (base_ != nullptr)
+            munmap(base_, limit_ - base_);
+    }
+
+    void* sbrk(std::size_t incr) {
+        if (incr > std::size_t(limit_ - brk_))
+            return reinterpret_cast<void*>(-1);
+        char *old = brk_;
+        brk_ += incr;
+        return old;
+    }
+    char* end() const { return brk_; }
+    // The used pages go back to the kernel, and fault back in zeroed
+    void reset() {
+        madvise(base_, brk_ - base_, MADV_DONTNEED);
+        brk_ = base_;
+    }
+
+private:
+    char *base_ = nullptr;   /* Start of the region */
+    char *brk_ = nullptr;    /* End of the heap */
+    char *limit_ = nullptr;  /* End of the region */
+};
+
+template <class Fit = best_fit, class Classes = tlsf_classes<>,
+          class Coalesce = immediate, std::size_t Align = 8,
+          class Source = memlib_source>
+class heap {
+    static_assert(Align == 8 || Align == 16, "Align must be 8 or 16");
+
+public:
+    static constexpr std::size_t alignment = Align;
+
+    heap() = default;
+    explicit heap(Source src) : src_(std::move(src)) {}
+
+    /* init - Lay out an empty heap at the current break, -1 on error */
+    int init() {
+        using namespace block;
+        char *start = src_.end();
+        // Pad the front so that the first payload is Align aligned
+        std::size_t pad = (Align - (std::size_t(start) + 4*WSIZE) % Align) % Align;
+        char *p = static_cast<char*>(src_.sbrk(pad + 4*WSIZE));
+        if (p == reinterpret_cast<char*>(-1))
+            return -1;
+        p += pad;
+        put(p, 0);                          // Alignment padding
+        put(p + WSIZE, DSIZE | 0b11);       // Prologue header
+        put(p + 2*WSIZE, DSIZE | 0b11);     // Prologue footer
+        put(p + 3*WSIZE, 0b11);             // Epilogue header
+        first_ = p + 4*WSIZE;
+        std::memset(roots_, 0, sizeof(roots_));
+        std::memset(map_, 0, sizeof(map_));
+        fit_.reset();
+        return extend(CHUNKSIZE) == nullptr ? -1 : 0;
+    }
+
+    /* malloc - Allocate a block with at least size bytes of payload */
+    void* malloc(std::size_t size) {
+        if (size == 0 || size > (std::size_t(1) << 31))
+            return nullptr;
+        if (first_ == nullptr && init() < 0)
+            return nullptr;
+        std::size_t asize = adjust(size);
+        void *bp = find_fit(asize);
+        if (bp == nullptr && !Coalesce::on_free) {
+            merge_all();
+            bp = find_fit(asize);
+        }
+        if (bp == nullptr && (bp = extend(grow_size(asize))) == nullptr)
+            return nullptr;
+        return place(bp, asize);
+    }
+
+    /* free - Free a block */
+    void free(void *bp) {
+        using namespace block;
+        if (bp == nullptr)
+            return;
+        hdr(bp) = std::uint32_t(size(bp) | (hdr(bp) & 2));
+        ftr(bp) = hdr(bp);
+        set_prev_alloc(next_blk(bp), false);
+        if (Coalesce::on_free)
+            bp = coalesce(bp);
+        else
+            merged_ = false;
+        insert(bp);
+    }
+
+    /* realloc - Grow or shrink in place if the block or its free next
+                 block has room, move the block otherwise */
+    void* realloc(void *ptr, std::size_t size) {
+        using namespace block;
+        if (size == 0) {
+            free(ptr);
+            return nullptr;
+        }
+        if (ptr == nullptr)
+            return malloc(size);
+        if (size > (std::size_t(1) << 31))
+            return nullptr;
+
+        std::size_t asize = adjust(size);
+        std::size_t csize = block::size(ptr);
+        void *nb = next_blk(ptr);
+        if (csize < asize && !alloc(nb) && csize + block::size(nb) >= asize) {
+            remove(nb);
+            csize += block::size(nb);
+            hdr(ptr) = std::uint32_t(csize | (hdr(ptr) & 2) | 1);
+            set_prev_alloc(next_blk(ptr), true);
+        }
+        if (csize >= asize) {
+            shrink(ptr, asize);
+            return ptr;
+        }
+
+        void *newptr = malloc(size);
+        if (newptr == nullptr)
+            return nullptr;
+        std::memcpy(newptr, ptr, csize - WSIZE);
+        free(ptr);
+        return newptr;
+    }
+
+    /* calloc - Allocate the block and set it to zero */
+    void* calloc(std::size_t nmemb, std::size_t size) {
+        if (size != 0 && nmemb > std::size_t(-1) / size)
+            return nullptr;
+        void *bp = malloc(nmemb * size);
+        if (bp != nullptr)
+            std::memset(bp, 0, nmemb * size);
+        return bp;
+    }
+
+    /* release - Free every block at once: the source goes back to empty
+                 and the heap is laid out again by the next malloc */
+    void release() {
+        src_.reset();
+        first_ = nullptr;
+        merged_ = false;
+    }
+
+    Source& source() { return src_; }
+
+    /* check - Walk the heap and the lists, returns the number of
+               violations; the first one is printed if verbose */
+    int check(bool verbose = false) const {
+        using namespace block;
+        int errors = 0;
+        std::size_t nfree = 0, nlisted = 0;
+        auto fail = [&](const char *msg, void *bp) {
+            if (errors++ == 0 && verbose)
+                std::fprintf(stderr, "mm::heap: %s (%p)\n", msg, bp);
+        };
+        if (first_ == nullptr)
+            return 0;
+
+        bool prev_free = false;
+        void *bp;
+        for (bp = first_; size(bp) != 0; bp = next_blk(bp)) {
+            if ((std::size_t(bp) & (Align - 1)) != 0 || size(bp) < MINBLOCKSIZE)
+                fail("bad block size or alignment", bp);
+            if (prev_alloc(bp) == prev_free)
+                fail("prev allocated bit does not match", bp);
+            if (!alloc(bp)) {
+                nfree++;
+                if (ftr(bp) != hdr(bp))
+                    fail("footer differs from header", bp);
+                if (prev_free && (Coalesce::on_free || merged_))
+                    fail("two free blocks next to each other", bp);
+            }
+            prev_free = !alloc(bp);
+        }
+        if (static_cast<char*>(bp) != src_.end() ||
+            prev_alloc(bp) == prev_free)
+            fail("bad epilogue", bp);
+
+        for (int c = 0; c < Classes::count; c++) {
+            void *prev = nullptr;
+            if ((roots_[c] != nullptr) != has_class(c))
+                fail("class bitmap disagrees with the list", roots_[c]);
+            for (bp = roots_[c]; bp != nullptr; prev = bp, bp = next(bp)) {
+                if (++nlisted > nfree)
+                    return errors + 1;   // A cycle, or an allocated block listed
+                if (alloc(bp) || Classes::index(size(bp)) != c)
+                    fail("listed block is allocated or in the wrong class", bp);
+                if (block::prev(bp) != prev)
+                    fail("broken prev link", bp);
+                if (Fit::sorted && prev != nullptr && size(prev) > size(bp))
+                    fail("sorted class out of order", bp);
+            }
+        }
+        if (nlisted != nfree)
+            fail("free blocks are missing from the lists", nullptr);
+        return errors;
+    }
+
+private:
+    static constexpr std::size_t CHUNKSIZE = 1 << 12; /* Least heap extension */
+    static constexpr int GROW_SHIFT = 5;              /* Grow by 1/2^GROW_SHIFT of the heap */
+    static constexpr std::size_t GROW_MAX = 1 << 20;  /* ...but by at most this much */
+    static constexpr std::size_t MINBLOCKSIZE =
+        (2*block::WSIZE + 2*block::DSIZE + Align - 1) & ~(Align - 1);
+    static constexpr int MAP_WORDS = (Classes::count + 63) / 64;
+
+    Source src_;                      /* Where the heap grows */
+    char *first_ = nullptr;           /* First block, nullptr until init */
+    bool merged_ = false;             /* No free block freed since merge_all */
+    void *roots_[Classes::count];     /* First block of each class */
+    std::uint64_t map_[MAP_WORDS];    /* Bit c set: class c is non-empty */
+    typename Fit::template state<Classes::count> fit_;
+
+    static void put(char *p, std::uint32_t val) {
+        *reinterpret_cast<std::uint32_t*>(p) = val;
+    }
+    static std::size_t align(std::size_t n) { return (n + Align - 1) & ~(Align - 1); }
+
+    /* adjust - Block size for a payload of size bytes */
+    static std::size_t adjust(std::size_t size) {
+        if (size + block::WSIZE <= MINBLOCKSIZE)
+            return MINBLOCKSIZE;
+        return align(size + block::WSIZE);
+    }
+
+    /* set_prev_alloc - Set the prev allocated bit of bp, and its footer if
+                        bp is free (deferred coalescing leaves free neighbours) */
+    static void set_prev_alloc(void *bp, bool a) {
+        using namespace block;
+        hdr(bp) = a ? hdr(bp) | 2 : hdr(bp) & ~2u;
+        if (!alloc(bp))
+            ftr(bp) = hdr(bp);
+    }
+
+    bool has_class(int c) const { return (map_[c >> 6] >> (c & 63)) & 1; }
+
+    /* grow_size - Bytes to extend the heap by for asize bytes: only the
+                   shortfall if the last block is free, as extend merges them */
+    std::size_t grow_size(std::size_t asize) const {
+        char *end = src_.end();
+        std::size_t heap = end - first_;
+        if (!(*reinterpret_cast<std::uint32_t*>(end - block::WSIZE) & 2)) {
+            std::size_t top = *reinterpret_cast<std::uint32_t*>(end - block::DSIZE) & ~7u;
+            if (top < asize)
+                return asize - top < MINBLOCKSIZE ? MINBLOCKSIZE : asize - top;
+        }
+        std::size_t step = heap >> GROW_SHIFT;
+        step = step < CHUNKSIZE ? CHUNKSIZE : step > GROW_MAX ? GROW_MAX : step;
+        return asize > step ? asize : align(step);
+    }
+
+    /* extend - Extend the heap by a free block of bytes, merged with a
+                free last block, and list it */
+    void* extend(std::size_t bytes) {
+        using namespace block;
+        bytes = align(bytes);
+        void *bp = src_.sbrk(bytes);
+        if (bp == reinterpret_cast<void*>(-1))
+            return nullptr;
+        // The old epilogue becomes the header of the new block
+        hdr(bp) = std::uint32_t(bytes | (hdr(bp) & 2));
+        ftr(bp) = hdr(bp);
+        hdr(next_blk(bp)) = 1;
+        bp = coalesce(bp);
+        insert(bp);
+        return bp;
+    }
+
+    /* coalesce - Merge free block bp, not listed, with its free
+                  neighbours, which leave their lists */
+    void* coalesce(void *bp) {
+        using namespace block;
+        std::size_t size = block::size(bp);
+        void *nb = next_blk(bp);
+        if (!alloc(nb)) {
+            remove(nb);
+            size += block::size(nb);
+        }
+        if (!prev_alloc(bp)) {
+            bp = prev_blk(bp);
+            remove(bp);
+            size += block::size(bp);
+        }
+        hdr(bp) = std::uint32_t(size | (hdr(bp) & 2));
+        ftr(bp) = hdr(bp);
+        return bp;
+    }
+
+    /* merge_all - Deferred coalescing: merge every run of free blocks
+                   into one block */
+    void merge_all() {
+        using namespace block;
+        for (void *bp = first_; size(bp) != 0; bp = next_blk(bp)) {
+            if (alloc(bp) || alloc(next_blk(bp)))
+                continue;
+            remove(bp);
+            while (!alloc(next_blk(bp)))
+                bp = coalesce(bp);
+            insert(bp);
+        }
+        merged_ = true;
+    }
+
+    /* find_fit - A listed block of at least asize bytes: searched in the
+                  class of asize, else any block of the next non-empty class */
+    void* find_fit(std::size_t asize) {
+        int c = Classes::index(asize);
+        if (has_class(c)) {
+            void *bp = fit_.find(roots_[c], c, asize);
+            if (bp != nullptr)
+                return bp;
+        }
+        for (int w = (c + 1) >> 6; w < MAP_WORDS; w++) {
+            std::uint64_t m = map_[w];
+            if (w == (c + 1) >> 6)
+                m &= ~std::uint64_t(0) << ((c + 1) & 63);
+            if (m != 0) {
+                int d = (w << 6) + __builtin_ctzll(m);
+                return fit_.find(roots_[d], d, asize);
+            }
+        }
+        return nullptr;
+    }
+
+    /* place - Take asize bytes from the front of listed block bp, the
+               rest is split off if it makes a block */
+    void* place(void *bp, std::size_t asize) {
+        using namespace block;
+        remove(bp);
+        hdr(bp) |= 1;
+        set_prev_alloc(next_blk(bp), true);
+        shrink(bp, asize);
+        return bp;
+    }
+
+    /* shrink - Cut allocated block bp down to asize bytes and free the tail
+                if it makes a block */
+    void shrink(void *bp, std::size_t asize) {
+        using namespace block;
+        std::size_t rsize = size(bp) - asize;
+        if (rsize < MINBLOCKSIZE)
+            return;
+        hdr(bp) = std::uint32_t(asize | (hdr(bp) & 2) | 1);
+        void *rest = next_blk(bp);
+        hdr(rest) = std::uint32_t(rsize | 0b11);
+        free(rest);
+    }
+
+    /* insert - List free block bp: at the front, or before the first
+                block not smaller than it in a sorted list */
+    void insert(void *bp) {
+        using namespace block;
+        std::size_t size = block::size(bp);
+        int c = Classes::index(size);
+        void *prev = nullptr;
+        void *next = roots_[c];
+
+        map_[c >> 6] |= std::uint64_t(1) << (c & 63);
+        if (Fit::sorted) {
+            while (next != nullptr && block::size(next) < size) {
+                prev = next;
+                next = block::next(next);
+            }
+        }
+        block::prev(bp) = prev;
+        block::next(bp) = next;
+        if (prev != nullptr)
+            block::next(prev) = bp;
+        else
+            roots_[c] = bp;
+        if (next != nullptr)
+            block::prev(next) = bp;
+    }
+
+    /* remove - Take bp off its list */
+    void remove(void *bp) {
+        using namespace block;
+        int c = Classes::index(size(bp));
+        void *prev = block::prev(bp);
+        void *next = block::next(bp);
+
+        fit_.removed(c, bp);
+        if (prev != nullptr)
+            block::next(prev) = next;
+        else
+            roots_[c] = next;
+        if (next != nullptr)
+            block::prev(next) = prev;
+        if (roots_[c] == nullptr)
+            map_[c >> 6] &= ~(std::uint64_t(1) << (c & 63));
+    }
+};
+
+} // namespace mm
+
+#endif /* MM_POLICY_HPP */
@@ -0,0 +1,159 @@
+/*
+ * mm-resource.hpp - std::pmr memory resources and an allocator over
+ *                   heaps of their own (mm-policy.hpp)
+ *
+ * Each resource owns a region of address space (region_source), so a
+ * container or a request can have a heap to itself, with no lock and no
+ * other thread in it, and give the whole heap back at once with release.
+ *
+ *  arena_resource<Heap>       blocks come from an mm::heap over the region;
+ *                             deallocate frees and coalesces them as usual
+ *  monotonic_resource         blocks are bumped off the end of the region
+ *                             and deallocate does nothing, so there is no
+ *                             per block free or coalesce work at all;
+ *                             memory comes back only with release
+ *
+ * Both are std::pmr::memory_resource, for the std::pmr containers, and
+ * mm::allocator<T, Resource> is a standard allocator bound to one of them
+ * by reference, for containers that take an allocator type; the resource
+ * classes are final, so its calls are not dispatched at run time. Neither
+ * resource is thread safe, and both must outlive the blocks they handed out:
+ *
+ *      mm::monotonic_resource arena;              // one per request
+ *      std::pmr::vector<int> v(&arena);
+ *      std::vector<int, mm::allocator<int, mm::monotonic_resource>> w(arena);
+ *      ...
+ *      arena.release();                           // the request is done
+ *
+ * Build with -std=c++17 or later.
+ */
+#ifndef MM_RESOURCE_HPP
+#define MM_RESOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+#include "mm-policy.hpp"
+
+namespace mm {
+
+template <class Heap = heap<best_fit, tlsf_classes<>, immediate, 16, region_source>>
+class arena_resource final : public std::pmr::memory_resource {
+public:
+    explicit arena_resource(std::size_t reserve = region_source::DEFAULT_RESERVE)
+        : heap_(region_source(reserve)) {}
+    arena_resource(const arena_resource&) = delete;
+    arena_resource& operator=(const arena_resource&) = delete;
+
+    /* release - Free every block handed out, and the pages under them */
+    void release() { heap_.release(); }
+
+    Heap& heap() { return heap_; }
+
+private:
+    Heap heap_;
+
+    // Alignments above the heap's take a larger block with the aligned
+    // payload inside it, and the start of the block in the word before
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        void *bp;
+        if (align <= Heap::alignment) {
+            if ((bp = heap_.malloc(bytes != 0 ? bytes : 1)) == nullptr)
+                throw std::bad_alloc();
+            return bp;
+        }
+        if ((bp = heap_.malloc(bytes + align)) == nullptr)
+            throw std::bad_alloc();
+        std::uintptr_t p = (std::uintptr_t(bp) + align) & ~std::uintptr_t(align - 1);
+        reinterpret_cast<void**>(p)[-1] = bp;
+        return reinterpret_cast<void*>(p);
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t align) override {
+        heap_.free(align <= Heap::alignment ? p : static_cast<void**>(p)[-1]);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+class monotonic_resource final : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t CHUNK = 64 * 1024; /* Least step of the source */
+
+    explicit monotonic_resource(std::size_t reserve = region_source::DEFAULT_RESERVE)
+        : src_(reserve), start_(src_.end()), cur_(start_) {}
+    monotonic_resource(const monotonic_resource&) = delete;
+    monotonic_resource& operator=(const monotonic_resource&) = delete;
+
+    /* release - Drop every block at once */
+    void release() {
+        src_.reset();
+        cur_ = start_;
+    }
+
+    /* used - Bytes handed out since the last release, with the padding */
+    std::size_t used() const { return cur_ - start_; }
+
+private:
+    region_source src_;
+    char *start_;                  /* Start of the region */
+    char *cur_;                    /* Next free byte */
+
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        std::uintptr_t p = (std::uintptr_t(cur_) + align - 1) & ~std::uintptr_t(align - 1);
+        char *end = src_.end();
+        if (p + bytes > std::uintptr_t(end)) {
+            // The source is contiguous: grow it by the shortfall, in chunks
+            std::size_t need = p + bytes - std::uintptr_t(end);
+            need = need < CHUNK ? CHUNK : (need + CHUNK - 1) & ~(CHUNK - 1);
+            if (src_.sbrk(need) == reinterpret_cast<void*>(-1))
+                throw std::bad_alloc();
+        }
+        cur_ = reinterpret_cast<char*>(p + bytes);
+        return reinterpret_cast<void*>(p);
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+/* A standard allocator of T over resource r */
+template <class T, class Resource>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator(Resource &r) noexcept : r_(&r) {}
+    template <class U>
+    allocator(const allocator<U, Resource> &o) noexcept : r_(o.resource()) {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::size_t(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T*>(r_->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T *p, std::size_t n) noexcept {
+        r_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    Resource* resource() const noexcept { return r_; }
+
+    template <class U>
+    bool operator==(const allocator<U, Resource> &o) const noexcept { return r_ == o.resource(); }
+    template <class U>
+    bool operator!=(const allocator<U, Resource> &o) const noexcept { return r_ != o.resource(); }
+
+private:
+    Resource *r_;
+};
+
+} // namespace mm
+
+#endif /* MM_RESOURCE_HPP */
@@ -3,6 +3,12 @@
  * lists, first-fit placement, and boundary tag coalescing, as described
  * in the CS:APP3e text. Blocks must be aligned to doubleword (8 byte) 
  * boundaries. Minimum block size is 16 bytes. 
+ *
+ * With -DNEXT_FIT the search is next fit instead: find_fit starts at the
+ * rover, the block it returned last time, and wraps around to the start
+ * of the heap, so a run of allocations does not rescan the blocks it just
+ * filled. coalesce moves the rover to the start of a merged block if it
+ * pointed inside it.
  */
 #include <stdio.h>
 #include <string.h>
@@ -23,7 +29,7 @@
 /*
  * If NEXT_FIT defined use next fit search, else use first-fit search 
  */
-#define NEXT_FITx
+//#define NEXT_FIT
 
 /* Basic constants and macros */
 #define WSIZE       4       /* Word and header/footer size (bytes) */ 
@@ -151,16 +157,16 @@ void *realloc(void *ptr, size_t size)
 
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
-        mm_free(ptr);
+        free(ptr);
         return 0;
     }
 
     /* If oldptr is NULL, then this is just malloc. */
     if(ptr == NULL) {
-        return mm_malloc(size);
+        return malloc(size);
     }
 
-    newptr = mm_malloc(size);
+    newptr = malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
@@ -173,7 +179,7 @@ void *realloc(void *ptr, size_t size)
     memcpy(newptr, ptr, oldsize);
 
     /* Free the old block. */
-    mm_free(ptr);
+    free(ptr);
 
     return newptr;
 }
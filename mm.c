@@ -8,17 +8,294 @@
  * Using the 2nd bit of the 3 free bits to indicate if previous block is free,
  * only free blocks in this allocater have both headers and footers. Allocated
  * blocks only have a header. 
+ * The 3rd bit of a free block's header is set if the block is known zero:
+ * every byte but its header, links and footer. Fresh memory from extend_heap
+ * is known zero in mmap arenas, and in arena 0 with MEMLIB_ZEROED (memlib
+ * memory past the highest break so far is zero, which mem_sbrk does not
+ * promise by itself). place passes the bit on to the remainder of a split,
+ * and calloc then only clears the links and footer of the block it gets.
+ * On an allocated heap block the same bit means grown (REALLOC_SLACK).
  * 
  * The segregated free lists are doubly linked lists. Every free block 
  * requires two 8-byte spaces to store pointers to previous and next
  * free blocks. Thus, minimum block size is 24 bytes. 
+ * With COMPACT_LINKS the two links are 32-bit offsets from the free block
+ * itself, counted in double words (NULL is 0), which reach 16 GiB either
+ * way and bring the minimum block size down to 16 bytes.
+ * The walks of find_fit and insert_to_free_list read the size and the next
+ * link of each block; the size is in the header, which shares a cache line
+ * with the links unless the payload starts a line. With SIZE_IN_NODE a
+ * listed block also keeps a copy of its size after its links, so that a
+ * walk touches one line per block, at the cost of 8 more bytes of minimum
+ * block size. Either way each step of a walk prefetches the block after
+ * the next one (NO_PREFETCH turns it off), so that its miss overlaps with
+ * the work on the next block.
+ *
+ * Heap growth: when no free block fits, the heap grows by the request or
+ * by 1/2^GROW_SHIFT of its size, whichever is larger, within
+ * [CHUNKSIZE, GROW_MAX], so that a growing heap calls mem_sbrk a
+ * logarithmic number of times. If the last block before the epilogue is
+ * free, only the shortfall is added, as the new space is coalesced with
+ * it. A new heap starts with a free block of INIT_HEAP bytes. All three can
+ * be set at compile time.
+ *
+ * Payloads are aligned to ALIGNMENT, 8 by default or 16 with
+ * -DALIGNMENT=16; block sizes are then multiples of 16 and the root table
+ * is padded so that the first block is aligned.
+ *
+ * Size classes form a two-level index (as in TLSF): the first level is the
+ * power of two of the size, the second level splits each power of two into
+ * SL_COUNT linear subclasses. Sizes >= 2^FL_MAX_LOG2 share one last class.
+ * Both parameters can be set at compile time (-DSL_LOG2=.. -DFL_MAX_LOG2=..).
+ *
+ * Free list policy, also selected at compile time:
+ *  default     every class is linked in ascending order of size
+ *  LIFO_LISTS  blocks are pushed to the front of their class in O(1);
+ *              find_fit tries FIT_PROBES blocks of the class of the request
+ *              and otherwise takes the first block of a larger class
+ *  LARGE_TREE  the last class is a treap keyed by (size, address), whose
+ *              left/right links reuse the prev/next pointer space, so the
+ *              best fit there is found in O(log n) in either mode
+ *  SPLIT_ENDS  blocks of PLACE_LARGE bytes or more are cut from the end of
+ *              the free block they are placed in, smaller ones from its
+ *              start, so that small and large blocks gather at opposite
+ *              ends of free space (at the top of the heap, large blocks
+ *              go high and small ones low) and small split remainders are
+ *              not left between large blocks. Blocks of equal size in a
+ *              sorted class are kept in address order, so that ties go to
+ *              the lowest address
+ *  FASTBINS    deferred coalescing: freed blocks under FAST_MAX bytes go
+ *              on a LIFO bin per exact size and stay marked allocated, so
+ *              free skips the header/footer rewrite, coalesce and the list
+ *              insert, and malloc of the same size pops them back. They are
+ *              merged into the free lists (fast_consolidate) when find_fit
+ *              fails, or when the bins hold more than FAST_MAX_BYTES
+ *
+ * Thread safety (THREAD_SAFE, on by default in the interpositioning build):
+ * the heap is protected by one lock, and each thread keeps a cache (tcache)
+ * of recently freed small blocks, one LIFO bin per size class. Cached blocks
+ * stay marked allocated in the heap, so the fast paths of malloc and free
+ * never take the lock. Bins are refilled and flushed TCACHE_BATCH blocks
+ * at a time under one lock acquisition, and bounded by TCACHE_COUNT blocks
+ * per bin and TCACHE_MAX_BYTES per thread. A thread's cache is flushed
+ * when the thread exits.
+ *
+ * Arenas: all heap state lives in an arena_t, each arena has its own lock,
+ * root table, prologue and epilogue. Arena 0 is the mem_sbrk heap. With
+ * MULTI_ARENA (on by default in the thread safe interpositioning build)
+ * up to MAX_ARENAS more arenas are created on demand, one per CPU, each in
+ * its own ARENA_SIZE aligned region reserved with mmap. A thread is bound
+ * to the arena of the CPU it first allocates on. Since regions are aligned,
+ * the owning arena of any block is found from its address (arena_of), which
+ * is how a free from another thread is routed back to the arena of the block.
+ *
+ * Remote frees (REMOTE_FREE, with MULTI_ARENA): a free of a block of an
+ * arena other than the thread's own does not take that arena's lock. The
+ * block stays marked allocated and is pushed onto the arena's remote
+ * queue, a lock-free stack many threads push to with compare and swap.
+ * This covers free, free_sized and the blocks of other arenas flushed from
+ * a tcache. An arena drains its queue whenever its lock is taken to
+ * allocate, resize or free (batches included): it takes the whole list
+ * at once, sorts it by address REMOTE_BATCH blocks at a time, and
+ * frees each run of adjacent heap blocks as one block, so the run is
+ * coalesced once. A pusher that finds REMOTE_MAX blocks queued drains
+ * them itself, but only if the lock is free, so the owner is never made
+ * to wait. Queued blocks count as allocated to mm_verify and mm_analyze.
+ *
+ * Slabs (on unless NO_SLABS): requests of up to SLAB_MAX bytes are served
+ * from slabs, page aligned allocated blocks of SLAB_SIZE bytes cut into
+ * identical slots, one slot size per multiple of ALIGNMENT. Slots have no
+ * header: a bit per page in the arena (slab_map) tells that a page is a
+ * slab, and the slab_t at the start of the page gives the slot size. Freed slots are
+ * linked through their first word, slots never used are carved in order.
+ * Slabs with a free slot are on a list per slot size; an empty slab goes
+ * back to the heap unless it is the last one of its size.
+ *
+ * Returning memory: requests of MMAP_THRESHOLD bytes or more get a mapping
+ * of their own (MMAP_HUGE, not under DRIVER), which free unmaps and realloc
+ * resizes with mremap. Their header is PACK(0, 1), like an epilogue, at
+ * page offset MMAP_HDR - WSIZE, after the length of the mapping; no slot
+ * or heap block looks like that. When a free leaves a block of at least
+ * TRIM_THRESHOLD bytes before the epilogue, its pages past TRIM_PAD are
+ * given back with madvise; the block stays in the heap, so mem_sbrk never
+ * has to shrink, and its pages fault back in zeroed when used again.
+ *
+ * Scavenging (SCAVENGE): free blocks of SCAVENGE_MIN bytes or more inside
+ * the heap give their pages back too. coalesce stamps such a block with
+ * the arena's epoch, which advances every SCAVENGE_PERIOD ms; once per
+ * epoch, found by free_now looking at the clock every SCAVENGE_EVERY
+ * frees, scavenge walks the large classes and drops the whole pages of the
+ * blocks free for SCAVENGE_AGE epochs and more with madvise, at most
+ * SCAVENGE_BYTES per epoch. The pages of the header, links, stamp and
+ * footer stay; the rest of those pages is cleared, so the block becomes
+ * known zero, which is how place and calloc know it is decommitted:
+ * calloc does not clear (and fault in) its pages. mm_scavenge drops the
+ * pages of every large free block at once, whatever their age.
+ *
+ * Huge pages (HUGE_PAGES): the heap regions are advised for transparent
+ * huge pages (MADV_HUGEPAGE), extend_heap ends every growth on a HUGE_PAGE
+ * boundary, mmap arenas commit HUGE_PAGE at a time, and trim_top gives
+ * back only whole huge pages, so none is split by a trim. With HUGETLB
+ * the committed steps of mmap arenas are explicit huge pages instead,
+ * mapped over the reserved region; they are reserved when mapped, so if
+ * the pool is short the step falls back to small pages rather than fault.
+ * The mem_sbrk heap belongs to memlib and only gets the advice.
+ *
+ * NUMA (NUMA_ARENAS, with MULTI_ARENA): a new arena's region prefers the
+ * memory of the node of the thread that creates it (mbind MPOL_PREFERRED,
+ * so a full node still falls back to the others). Arenas are per CPU, and
+ * the creating thread runs on the arena's CPU, so threads allocate on
+ * their own node.
+ *
+ * Growth slack (REALLOC_SLACK): realloc marks a heap block it grew, in
+ * place or by moving it, as grown. The mark goes when the block is freed,
+ * also into the tcache or a fast bin, where it stays allocated (a new
+ * block has not grown). A grown block that grows again is a buffer
+ * being appended to, so it is given 1/2^SLACK_SHIFT of its size (at most
+ * SLACK_MAX bytes) on top of the request, whether it grows in place or
+ * moves, and a move places it at the front of the free block it
+ * is cut from (even under SPLIT_ENDS), so that the remainder right after
+ * it is room for the next growth. The arena remembers the last GROW_TAILS
+ * such free blocks after grown blocks, and place cuts other allocations
+ * from the end of one of those, keeping the room next to the buffer.
+ * Fewer growths then have to move and copy.
+ *
+ * Sized free and alignment: free_sized trusts the size the caller passes
+ * (the size it asked for): above SLAB_MAX the block cannot be a slot, and
+ * below MMAP_THRESHOLD it cannot be mapped, so those lookups are skipped
+ * and the block goes straight to the tcache or the arena. The tcache bin
+ * still comes from the header, as the block may be larger than asked (a
+ * tail too small to split, realloc slack) and the cache counts real
+ * bytes. With assertions on, the size is checked against the block.
+ * aligned_alloc and posix_memalign take an aligned block out of a larger
+ * one (malloc_aligned_block) when the alignment is above ALIGNMENT.
+ *
+ * Batches: mm_malloc_batch carves runs of blocks of one size out of a
+ * single free block (or a new extend_heap block) under one lock, placing
+ * the whole run at once. mm_free_batch sorts the pointers by address and
+ * frees each run of adjacent heap blocks as one block, so the run is
+ * coalesced and put on a free list once.
+ *
+ * Heap checking: mm_verify checks the heap at one of three levels (see
+ * verify_arena) and returns the number of violations, with the first one
+ * as an mm_heap_error_t; MM_CHECK_PARALLEL checks each arena in a thread
+ * of its own. mm_checkheap is mm_verify(MM_CHECK_FULL) printing the first
+ * violation. With -DHEAP_CHECK=<level> every block passed to or returned
+ * by malloc, calloc, realloc and free gets an O(1) check of its header and
+ * of the prev allocated bit of the next block, and every CHECK_EVERY
+ * operations a thread verifies the heap at that level (from
+ * MM_CHECK_WALK up); a violation is printed and aborts.
+ *
+ * Hardening (HARDENED): free checks that a heap block is still marked
+ * allocated, that its size is sane and that the next block has the prev
+ * allocated bit set (an overflow into the next header usually clears or
+ * garbles it), and that a slot pointer is a slot of its slab; a violation
+ * is printed and aborts. Blocks that stay marked allocated while free (in
+ * a tcache bin, a fast bin or the free slots of a slab) carry a random
+ * 32-bit key in bytes 8..11 of the payload; only when a freed block has the
+ * key is the list it would be on walked, so a double free costs nothing
+ * until it happens (8-byte slots have no room for the key). All free list
+ * links are stored XOR-masked with their own address shifted right by 12
+ * and a per-process secret (safe-linking), and an unlink checks that the
+ * neighbours point back at the block, so a corrupted or forged link is
+ * caught instead of followed. Outside the driver, about one in GUARD_RATE
+ * requests of at most GUARD_MAX bytes goes to a page of its own in a
+ * reserved region, with the payload ending where an inaccessible page
+ * starts (give or take the rounding to ALIGNMENT), so an overflow faults
+ * on the spot. A freed guarded page is made inaccessible and only reused
+ * once the region has been used up, oldest first, so most use after free
+ * of these blocks faults too.
+ *
+ * Heap profile (PROFILE): about every PROF_RATE bytes allocated (the gaps
+ * are exponentially distributed, so that each byte is equally likely to be
+ * sampled) the block being allocated gets its backtrace and size recorded
+ * in a live table keyed by address. The malloc fast path only subtracts the
+ * size from a per-thread count of bytes left to the next sample; free
+ * looks the block up only if its slot in a counting filter (prof_filter)
+ * is non-zero. mm_prof_dump writes the live samples in the legacy text heap
+ * profile format ("heap_v2") that pprof reads, and the profile is written
+ * at exit to the file named by MM_PROF. MM_PROF_RATE (or
+ * mm_prof_set_rate) sets the rate, 0 turns sampling off.
+ *
+ * Trace recording (TRACE): when MM_TRACE names a file at startup, every
+ * malloc, calloc, aligned_alloc, realloc and free from then on is recorded
+ * to it, for mmbench to replay. Each thread appends records to a
+ * TRACE_BUF byte buffer of its own without a lock; a full buffer (or the
+ * buffer of an exiting thread) is queued for a writer thread and swapped
+ * for an empty one, so only one lock acquisition per buffer is on the
+ * allocation path, and the file is written asynchronously. If the writer
+ * falls TRACE_BUFS_MAX buffers behind, records are dropped (and counted on
+ * stderr at exit) rather than the caller blocked. The file is the magic
+ * "MMTRACE1" followed by chunks, one per buffer: a 4-byte thread number,
+ * 4-byte length and 8-byte start time, then the records. A record is a
+ * type byte (1 malloc, 2 free, 3 realloc) and LEB128 varints: the time
+ * since the previous record of the chunk (TSC cycles on x86, nanoseconds
+ * elsewhere), then for malloc the size and result, for free the pointer,
+ * for realloc the old pointer, size and result. Pointers are zigzag
+ * coded differences from the previous pointer of the chunk, in units of
+ * 8 bytes. calloc is recorded as a malloc of the total size, and realloc
+ * as one operation however it is carried out.
+ *
+ * Statistics (STATS): mm.c counts mallocs and frees per size class, the
+ * blocks find_fit and insert_to_free_list walk, splits, the four coalesce
+ * cases, heap extensions, scavenging, and the current and peak heap size.
+ * Per size class it also counts the bytes malloc adds by rounding requests
+ * up to a block or slot size, and the bytes place leaves in a block as a
+ * remainder too small to split off. mm_stats copies the counters,
+ * mm_stats_print prints them, and they are printed to stderr at exit if
+ * MM_STATS is set in the environment. Without STATS the counting macros
+ * expand to nothing.
+ *
+ * Heap analysis: mm_analyze walks every arena like mm_verify does and
+ * fills an mm_analysis_t: free and allocated blocks and bytes per size
+ * class (the classes of get_class, so the histogram shows which class
+ * boundaries leave free blocks that requests do not fit), the largest free
+ * block, the slab bytes and how much of them is handed out, and for each
+ * arena its occupancy in MM_ANALYZE_SPANS equal spans of its heap.
+ * mm_analysis_print prints it, with the external fragmentation (the part
+ * of the free bytes outside the largest free block) and, with STATS, the
+ * internal fragmentation from rounding and unsplit remainders.
  */ 
 
+/* sched_getcpu */
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef HARDENED
+#include <sys/auxv.h>
+#endif
+#ifdef PROFILE
+#include <execinfo.h>
+#endif
+#if defined(PROFILE) || defined(TRACE)
+#include <fcntl.h>
+#endif
+#ifdef TRACE
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef SCAVENGE
+#include <time.h>
+#endif
+#ifdef NUMA_ARENAS
+#include <sys/syscall.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1   /* From <numaif.h>, not needed otherwise */
+#endif
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -39,24 +316,278 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define free_sized mm_free_sized
+#define aligned_alloc mm_aligned_alloc
+#define posix_memalign mm_posix_memalign
 #endif /* def DRIVER */
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) or quad word (16) alignment */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
+#if ALIGNMENT != 8 && ALIGNMENT != 16
+#error "ALIGNMENT must be 8 or 16"
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
-
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
-#define SIZE_PTR(p)  ((size_t*)(((char*)(p)) - SIZE_T_SIZE))
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 /* Basic constants and macros from mm-textbook.c */
 #define WSIZE       4       /* Word and header/footer size (bytes) */ 
 #define DSIZE       8       /* Double word size (bytes) */
-#define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */ 
-#define MINBLOCKSIZE 3*DSIZE /* Minimum block size = 24 bytes */
+#define CHUNKSIZE  (1<<12)  /* Extend heap by at least this amount (bytes) */ 
+
+/* Heap growth, see top of file */
+#ifndef INIT_HEAP
+#define INIT_HEAP   CHUNKSIZE  /* First free block of a new heap (bytes) */
+#endif
+#ifndef GROW_SHIFT
+#define GROW_SHIFT  5          /* Grow by 1/2^GROW_SHIFT of the heap... */
+#endif
+#ifndef GROW_MAX
+#define GROW_MAX    (1 << 20)  /* ...but by at most this much beyond the request */
+#endif
+
+/* Free list links, see top of file */
+//#define COMPACT_LINKS
+#ifdef COMPACT_LINKS
+#define LINKSIZE    WSIZE   /* Offset from the block to the linked block */
+#else
+#define LINKSIZE    DSIZE   /* Pointer to the linked block */
+#endif
+
+/* Body of a listed free block: the two links, then the size with SIZE_IN_NODE */
+//#define SIZE_IN_NODE
+#ifdef SIZE_IN_NODE
+#define NODESIZE    (2*LINKSIZE + WSIZE)
+#else
+#define NODESIZE    (2*LINKSIZE)
+#endif
+
+/* Minimum block size: header, free block body and footer, aligned.
+   24 bytes; 16 with COMPACT_LINKS; 32 with ALIGNMENT 16 or SIZE_IN_NODE */
+#define MINBLOCKSIZE ALIGN(2*WSIZE + NODESIZE)
+
+/* Segregated size classes: two-level index */
+#ifndef SL_LOG2
+#define SL_LOG2     2       /* log2 of number of subclasses per power of two */
+#endif
+#ifndef FL_MAX_LOG2
+#define FL_MAX_LOG2 20      /* Sizes >= 2^FL_MAX_LOG2 share the last class */
+#endif
+#define SL_COUNT    (1 << SL_LOG2)
+#define FL_MIN_LOG2 (SL_LOG2 + 3) /* Group 0 holds sizes < 2^FL_MIN_LOG2 in 8 byte steps */
+#define FL_COUNT    (FL_MAX_LOG2 - FL_MIN_LOG2 + 1) /* Groups below the last class */
+#define NUM_CLASSES (FL_COUNT*SL_COUNT + 1) /* Last class is group FL_COUNT */
+
+/* Free list policy, see top of file */
+//#define LIFO_LISTS
+//#define LARGE_TREE
+//#define SPLIT_ENDS
+//#define FASTBINS
+
+#ifdef LIFO_LISTS
+#define FIT_PROBES  8         /* Blocks of its own class find_fit tries first */
+#else
+#define FIT_PROBES  (1 << 30) /* Sorted classes are walked to the end */
+#endif
+
+#ifdef SPLIT_ENDS
+#ifndef PLACE_LARGE
+#define PLACE_LARGE 4096      /* Blocks placed at the end of a free block */
+#endif
+#endif
+
+#ifdef FASTBINS
+#define FAST_MAX       512                /* Blocks below this size are deferred */
+#define FAST_BINS      (FAST_MAX / DSIZE) /* One bin per block size */
+#define FAST_MAX_BYTES (64*1024)          /* Consolidate past this many deferred bytes */
+#endif
+
+/* Thread safety, see top of file */
+#if !defined(DRIVER) && !defined(SINGLE_THREADED) && !defined(THREAD_SAFE)
+#define THREAD_SAFE
+#endif
+
+#ifdef THREAD_SAFE
+#define TCACHE
+#define TCACHE_MAX_LOG2  10          /* Cache blocks smaller than 1024 bytes */
+#define TCACHE_COUNT     16          /* Max blocks in a bin */
+#define TCACHE_BATCH     8           /* Blocks moved per refill or flush */
+#define TCACHE_MAX_BYTES (64*1024)   /* Max bytes cached by one thread */
+#define TCACHE_CLASSES   ((TCACHE_MAX_LOG2 - FL_MIN_LOG2 + 1) << SL_LOG2)
+
+#define LOCK(a)    pthread_mutex_lock(&(a)->lock)
+#define UNLOCK(a)  pthread_mutex_unlock(&(a)->lock)
+#else
+#define LOCK(a)    ((void) 0)
+#define UNLOCK(a)  ((void) 0)
+#endif
+
+/* Huge pages, see top of file */
+//#define HUGE_PAGES
+//#define HUGETLB
+#if defined(HUGETLB) && !defined(HUGE_PAGES)
+#define HUGE_PAGES
+#endif
+#ifdef HUGE_PAGES
+#define HUGE_PAGE   (2 << 20)  /* Huge page size and alignment */
+#endif
+
+/* Arenas, see top of file */
+#if defined(THREAD_SAFE) && !defined(DRIVER) && !defined(SINGLE_ARENA)
+#define MULTI_ARENA
+#endif
+
+#ifdef MULTI_ARENA
+#define MAX_ARENAS  64                         /* Arenas besides the mem_sbrk heap */
+#define ARENA_LOG2  32
+#define ARENA_SIZE  ((size_t) 1 << ARENA_LOG2) /* Size and alignment of an arena region */
+#ifdef HUGE_PAGES
+#define ARENA_COMMIT HUGE_PAGE                 /* Region made read/write a huge page at a time */
+#else
+#define ARENA_COMMIT (1 << 20)                 /* Region made read/write in steps of 1 MiB */
+#endif
+//#define NUMA_ARENAS
+//#define REMOTE_FREE
+#define REMOTE_BATCH 64                        /* Remote frees sorted and joined at a time */
+#define REMOTE_MAX  1024                       /* Remote frees queued before a pusher drains */
+#else
+#define MAX_ARENAS  0
+#endif
+#if defined(REMOTE_FREE) && !defined(MULTI_ARENA)
+#undef REMOTE_FREE
+#endif
+
+#ifdef REMOTE_FREE
+/* Free the blocks queued for arena a by other threads, lock of a held */
+#define REMOTE_DRAIN(a) \
+    do { if (__atomic_load_n(&(a)->remote, __ATOMIC_RELAXED) != NULL) remote_drain(a); } while (0)
+#else
+#define REMOTE_DRAIN(a)
+#endif
+
+/* Slabs, see top of file */
+#ifndef NO_SLABS
+#define SLABS
+#endif
+
+#ifdef SLABS
+#define SLAB_LOG2      12
+#define SLAB_SIZE      (1 << SLAB_LOG2)   /* Slab size and alignment */
+#define SLAB_MAX       128                /* Largest request served by a slab */
+#define SLAB_CLASSES   (SLAB_MAX / ALIGNMENT) /* Slot sizes ALIGNMENT, .., SLAB_MAX */
+#define SLAB_HDR       ALIGN(sizeof(struct slab)) /* Slots start after the slab_t */
+#define SLAB_SPAN_LOG2 32                 /* Slabs lie in the first 4 GiB of an arena */
+#define SLAB_MAP_WORDS (1 << (SLAB_SPAN_LOG2 - SLAB_LOG2 - 6))
+
+/* Slab class of a request, and its slot size */
+#define SLAB_CLASS(size) (((size) - 1) / ALIGNMENT)
+#define SLAB_SLOT(c)     (((size_t) (c) + 1) * ALIGNMENT)
+#endif
+
+/* Returning memory, see top of file */
+#if !defined(DRIVER) && !defined(NO_MMAP)
+#define MMAP_HUGE
+#endif
+#define MMAP_THRESHOLD (128*1024) /* Requests mapped on their own */
+#define MMAP_HDR       (2*DSIZE)  /* Mapping length and header before the payload */
+#define TRIM_THRESHOLD (256*1024) /* Last free block size, and unused bytes, to trim */
+#define TRIM_PAD       (64*1024)  /* Bytes of the last free block kept resident */
+
+/* Heap checking, see top of file */
+//#define HEAP_CHECK MM_CHECK_WALK
+#ifndef CHECK_EVERY
+#define CHECK_EVERY    4096       /* Operations of a thread between heap checks */
+#endif
+
+#ifdef HEAP_CHECK
+#define CHECK_OP(bp)   check_op(bp)
+#else
+#define CHECK_OP(bp)
+#endif
+
+/* Batches, see top of file */
+#define BATCH_BYTES    (1 << 20)  /* Most bytes carved as one run */
+
+/* Statistics, see top of file */
+//#define STATS
+
+/* Hardening, see top of file */
+//#define HARDENED
+#if defined(HARDENED) && defined(MMAP_HUGE)
+#define GUARD_PAGES
+#define GUARD_RATE     1024       /* Mean requests between guarded ones */
+#define GUARD_SLOTS    (1 << 14)  /* Guarded blocks live at most */
+#define GUARD_MAX      (4096 - DSIZE) /* Largest request guarded */
+#endif
+
+/* Heap profile, see top of file */
+//#define PROFILE
+#ifdef PROFILE
+#define PROF_RATE      (512*1024) /* Mean bytes between samples */
+#define PROF_DEPTH     32         /* Frames kept per sample */
+#define PROF_BUCKETS   4096       /* Hash table of live samples */
+#define PROF_FILTER    (1 << 16)  /* Counting filter entries */
+#define PROF_HASH(bp)  (((size_t) (bp) >> 4) * 0x9e3779b97f4a7c15ULL >> 48)
+#define PROF_CHUNK     (64*1024)  /* Samples are carved from mappings this large */
+#endif
+
+/* Trace recording, see top of file */
+//#define TRACE
+#ifdef TRACE
+#define TRACE_BUF      (64*1024)  /* Bytes of records per buffer */
+#define TRACE_BUFS_MAX 1024       /* Buffers mapped at most */
+#define TRACE_REC_MAX  48         /* Longest record */
+#define TRACE_MALLOC   1          /* Record types */
+#define TRACE_FREE     2
+#define TRACE_REALLOC  3
+#endif
+
+/* Scavenging, see top of file */
+//#define SCAVENGE
+#ifdef SCAVENGE
+#define SCAVENGE_MIN    (16*1024)  /* Least free block scavenged */
+#define SCAVENGE_PERIOD 100        /* Milliseconds per epoch */
+#define SCAVENGE_AGE    2          /* Epochs a block is free before it is scavenged */
+#define SCAVENGE_BYTES  (16 << 20) /* Most bytes given back per epoch and arena */
+#define SCAVENGE_EVERY  256        /* Frees of an arena between looks at the clock */
+#define STAMP(bp)       GET((char *)(bp) + NODESIZE) /* Epoch the block was freed in */
+#define SET_STAMP(bp, e) PUT((char *)(bp) + NODESIZE, (e))
+#endif
+
+/* Growth slack, see top of file */
+//#define REALLOC_SLACK
+#ifdef REALLOC_SLACK
+#define SLACK_SHIFT    1          /* A grown block gets 1/2^SLACK_SHIFT more */
+#define SLACK_MAX      (1 << 20)  /* ...but at most this many bytes */
+#define GROW_TAILS     8          /* Free blocks after grown blocks remembered */
+#endif
+
+/* calloc clears blocks of at least this size with non-temporal stores */
+#define ZERO_NT_MIN    (256*1024)
+
+#if SL_LOG2 < 0 || SL_LOG2 > 5
+#error "SL_LOG2 must be in 0..5"
+#endif
+#if MAX_ARENAS + 1 > MM_ANALYZE_ARENAS
+#error "More arenas than MM_ANALYZE_ARENAS"
+#endif
+#if FL_MAX_LOG2 <= FL_MIN_LOG2 || FL_COUNT + 1 > 64
+#error "FL_MAX_LOG2 out of range"
+#endif
+#if defined(COMPACT_LINKS) && defined(MULTI_ARENA) && ARENA_LOG2 > 34
+#error "COMPACT_LINKS reach 16 GiB, ARENA_LOG2 is too large"
+#endif
+#if defined(TCACHE) && TCACHE_MAX_LOG2 >= FL_MAX_LOG2
+#error "TCACHE_MAX_LOG2 must be below FL_MAX_LOG2"
+#endif
+#if defined(STATS) && NUM_CLASSES > MM_STATS_CLASSES
+#error "More size classes than MM_STATS_CLASSES"
+#endif
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) 
@@ -73,6 +604,15 @@
 #define GET_SIZE(p)  (GET(p) & ~0x7)                   
 #define GET_ALLOC(p) (GET(p) & 0x1) // 1: Allocated ; 0: Free
 #define GET_PREV_ALLOC(p) (GET(p) & 0x2) // 1: Prev is allocated; 0: Prev is free
+#define GET_ZERO(p) (GET(p) & 0x4) // Free block only, 1: Known zero
+#ifdef REALLOC_SLACK
+#define GET_GROWN(p) (GET(p) & 0x4) // Allocated heap block only, 1: Grown by realloc
+#define MARK_GROWN(a, bp) mark_grown(a, bp)
+#define CLEAR_GROWN(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~0x4) // Heap block reused as it is
+#else
+#define MARK_GROWN(a, bp)
+#define CLEAR_GROWN(bp)
+#endif
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      
@@ -83,154 +623,798 @@
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) 
 
+/* Safe-linking: a link stored at pos is masked with pos and a secret */
+#ifdef HARDENED
+static size_t link_secret;   /* Random, set once by the first heap_init */
+static inline void* link_reveal(void *bp);
+#define PROTECT(pos, ptr) ((size_t) (ptr) ^ ((size_t) (pos) >> 12) ^ link_secret)
+#else
+#define PROTECT(pos, ptr) ((size_t) (ptr))
+#endif
+#define REVEAL(pos, val)  PROTECT(pos, val)
+
+/* Link of a block on a singly linked list (tcache and fast bins, free
+   slots), in the first word of its payload */
+#ifdef HARDENED
+#define GET_LINK(bp)      link_reveal(bp)
+#else
+#define GET_LINK(bp)      ((void *) GET_8B(bp))
+#endif
+#define SET_LINK(bp, q)   PUT_8B(bp, PROTECT(bp, q))
+
+/* Double free key of a block on one of those lists, which stays marked
+   allocated; payloads of size bytes <= DSIZE have no room for it */
+#ifdef HARDENED
+#define FREE_KEY(bp)      (*(unsigned int *)((char *)(bp) + DSIZE))
+#define FREE_KEY_VALUE    ((unsigned int) (link_secret >> 32) | 1)
+#define SET_KEY(bp, size) do { if ((size) > DSIZE) FREE_KEY(bp) = FREE_KEY_VALUE; } while (0)
+#define CLEAR_KEY(bp, size) do { if ((size) > DSIZE) FREE_KEY(bp) = 0; } while (0)
+#else
+#define SET_KEY(bp, size)
+#define CLEAR_KEY(bp, size)
+#endif
+
+/* Size of listed free block bp as the free list walks read it */
+#ifdef SIZE_IN_NODE
+#define NODE_SIZE(bp)           GET((char *)(bp) + 2*LINKSIZE)
+#define SET_NODE_SIZE(bp, size) PUT((char *)(bp) + 2*LINKSIZE, (size))
+#else
+#define NODE_SIZE(bp)           GET_SIZE(HDRP(bp))
+#define SET_NODE_SIZE(bp, size)
+#endif
+
+/* Prefetch the block at p for reading, p may be NULL */
+#if defined(__GNUC__) && !defined(NO_PREFETCH)
+#define PREFETCH(p)  __builtin_prefetch((const void *)(p))
+#else
+#define PREFETCH(p)
+#endif
+
 /* For manipulation of segregated free list only.
 Get or set prev and next pointer from address p 
 64 bit machine = Pointer is 8 bytes = sizeof(size_t) */
-#define GET_PREVP(p) (*(size_t *)(p))
-#define GET_NEXTP(p) (*((size_t *)(p) + 1))
-#define SET_PREVP(p, prev) (*(size_t *)(p) = (prev))
-#define SET_NEXTP(p, val) (*((size_t *)(p) + 1) = (val))
+#ifndef COMPACT_LINKS
+#define GET_PREVP(p) REVEAL(p, *(size_t *)(p))
+#define GET_NEXTP(p) REVEAL((size_t *)(p) + 1, *((size_t *)(p) + 1))
+#define SET_PREVP(p, prev) (*(size_t *)(p) = PROTECT(p, prev))
+#define SET_NEXTP(p, val) (*((size_t *)(p) + 1) = PROTECT((size_t *)(p) + 1, val))
+#else
+/* Link w of block p is a 32-bit offset from p in double words, 0 for NULL.
+   A block never links to itself */
+static inline size_t link_get(void *p, int w) {
+    int off = ((int *)(p))[w] ^ (int) PROTECT((int *)(p) + w, 0);
+    return off ? (size_t) ((char *)(p) + (long) off * DSIZE) : (size_t) NULL;
+}
+static inline void link_put(void *p, int w, size_t q) {
+    int off = q ? (int) (((char *)(q) - (char *)(p)) / DSIZE) : 0;
+    ((int *)(p))[w] = off ^ (int) PROTECT((int *)(p) + w, 0);
+}
+#define GET_PREVP(p) link_get((void *)(p), 0)
+#define GET_NEXTP(p) link_get((void *)(p), 1)
+#define SET_PREVP(p, prev) link_put((void *)(p), 0, (prev))
+#define SET_NEXTP(p, val) link_put((void *)(p), 1, (val))
+#endif
 
-/* Global variables */
-static char *heap_listp = 0;  /* Pointer to the start of heap */
-static char *seg_free_listp = 0;  /* Pointer to the start of segregated free list */
+#ifdef SLABS
+/* Start of a slab page */
+typedef struct slab {
+    struct slab *prev;     /* Slabs with a free slot, of the same slot size */
+    struct slab *next;
+    void *free;            /* Freed slots, linked through their first word */
+    unsigned short size;   /* Slot size */
+    unsigned short nslots; /* Slots in the slab */
+    unsigned short used;   /* Slots handed out */
+    unsigned short carved; /* Slots from here on were never handed out */
+} slab_t;
+#endif
 
+/* An independent heap */
+typedef struct arena {
+    char *heap_listp;      /* Pointer to the start of heap, 0 until laid out */
+    char *seg_free_listp;  /* Pointer to the start of segregated free list */
+    size_t fl_bitmap;      /* Bit g set: group g has a non-empty class */
+    unsigned int sl_bitmap[FL_COUNT + 1];  /* Bit s set: class s of the group is non-empty */
+    char *base;            /* Start of the region (mmap arenas) */
+    char *brk;             /* End of the heap in the region */
+    char *committed;       /* End of the read/write part of the region */
+    int id;                /* 0: mem_sbrk heap */
+    char *dirty_end;       /* Heap past here is untouched since the last trim */
+    char *fresh;           /* Highest break so far, memory past it was never used */
+    int placed_zero;       /* The block last placed came from a known zero block */
+#ifdef NUMA_ARENAS
+    int node;              /* NUMA node preferred for the region, -1 if unknown */
+#endif
+#ifdef REALLOC_SLACK
+    int grow_front;        /* place keeps the block at the front, for grow_alloc */
+    void *grow_tails[GROW_TAILS]; /* Free blocks right after grown blocks, */
+    unsigned int grow_tail_next;  /* the oldest one is replaced first */
+#endif
+#ifdef SCAVENGE
+    unsigned int scav_epoch; /* Epochs since the arena was created */
+    unsigned int scav_ops;   /* Frees since the clock was looked at */
+    long scav_time;          /* Millisecond the epoch started at */
+#endif
+#ifdef STATS
+    size_t heap_bytes;     /* Bytes from arena_sbrk since heap_init */
+#endif
+#ifdef FASTBINS
+    void *fastbins[FAST_BINS]; /* Deferred frees, linked through their first word */
+    size_t fast_bytes;     /* Total size of deferred frees */
+#endif
+#ifdef SLABS
+    slab_t *slabs[SLAB_CLASSES]; /* Slabs with a free slot, per slot size */
+    size_t slab_words;     /* Words of slab_map that may be non-zero */
+    unsigned long slab_map[SLAB_MAP_WORDS]; /* Bit p set: page p is a slab */
+#endif
+#ifdef THREAD_SAFE
+    pthread_mutex_t lock;  /* Protects all of the above */
+#endif
+#ifdef REMOTE_FREE
+    /* Pushed to by other threads without the lock, on a line of their own */
+    void *remote __attribute__((aligned(64))); /* Blocks freed remotely, linked */
+    unsigned long remote_count; /* Blocks pushed since the last drain */
+#endif
+} arena_t;
 
-/* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
+/* State of a heap check: violations found and where the first one goes */
+typedef struct {
+    mm_heap_error_t *err;  /* First violation, may be NULL */
+    int count;             /* Violations so far */
+    int arena;             /* Arena being checked */
+} check_t;
 
-/* Function prototypes for manipulating segregated free list */
-static void* get_root(size_t size);
-static void remove_from_free_list(void *bp);
-static void insert_to_free_list(void* bp);
+/* Global variables */
+static arena_t arenas[MAX_ARENAS + 1] = {
+#ifdef THREAD_SAFE
+    [0] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+#endif
+};
 
+#ifdef MULTI_ARENA
+static int narenas = 0;           /* Arenas in use, from the number of CPUs */
+static unsigned int arena_next;   /* Round robin, when the CPU is unknown */
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects creation */
+static __thread arena_t *thread_arena; /* Arena of this thread */
+#endif
 
-/*
-* get_root - Given a size, get the address of the start of the free list
-*/
-static void* get_root(size_t size) {
-    int i = 0;
-    if (size <= 32) i=0;
-    else if (size <= 64) i=1;
-    else if (size <= 128) i=2;
-    else if (size <= 256) i=3;
-    else if (size <= 512) i=4;
-    else if (size <= 1024) i=5;
-    else if (size <= 2048) i=6;
-    else if (size <= 4096) i=7;
-    else if (size <= 8192) i=8;
-    else  i=9;
-    dbg_printf("get_root: i=%d size=%zu\n", i, size);
-    return seg_free_listp + (i*DSIZE);
-}
+#ifdef STATS
+static mm_stats_t stats;
 
-/*
- * remove_from_free_list - remove the block from the segregated free list
-                            Link the blocks from left and right
-                            Take note: 4 cases on where the block could be removed from
-                            Case 1: Prev block is root, next block is NULL
-                            Case 2: Prev block is not root, next block is NULL
-                            Case 3: Prev block is root, next block is not NUll
-                            Case 4: Prev block is not root, next block is not NULL
- */ 
-static void remove_from_free_list(void *bp) {
-    // Make sure bp is valid to be removed from the list
-    if (bp == NULL || GET_ALLOC(HDRP(bp)))
-        return;
+/* Counters are shared by all arenas and threads */
+#ifdef THREAD_SAFE
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(field, n) (stats.field += (n))
+#endif
+#define STAT_HEAP(delta)   stat_heap((long) (delta))
+#define STAT_BLOCK(field, bp) \
+    do { if ((bp) != NULL) STAT_ADD(field[stat_class(bp)], 1); } while (0)
+#else
+#define STAT_ADD(field, n)
+#define STAT_HEAP(delta)
+#define STAT_BLOCK(field, bp)
+#endif
 
-    // Get the block's root, prev and next
-    void *root = get_root(GET_SIZE(HDRP(bp))); 
-    void* prev = (void*) GET_PREVP(bp);
-    void* next = (void*) GET_NEXTP(bp);
+#ifdef PROFILE
+/* A live sampled block */
+typedef struct prof_sample {
+    struct prof_sample *next;   /* Next sample in the bucket, or free sample */
+    void *bp;
+    size_t size;
+    int depth;
+    void *stack[PROF_DEPTH];
+} prof_sample_t;
 
-    // Sever the block from the free list first
-    SET_PREVP(bp, (size_t) NULL);
-    SET_NEXTP(bp, (size_t) NULL);
+static prof_sample_t *prof_table[PROF_BUCKETS];
+static prof_sample_t *prof_free_samples;   /* Unused samples */
+static unsigned short prof_filter[PROF_FILTER]; /* Live samples per hash */
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects all of the above */
+static long prof_rate = -1;                /* Set from MM_PROF_RATE on first use */
+static __thread long prof_left;            /* Bytes to allocate before the next sample */
+static __thread int prof_busy;             /* This thread is in the profiler */
+static __thread unsigned long prof_rand;   /* xorshift state */
 
-    if (prev == NULL && next == NULL) { 
-        // Case 1: Set root to NULL
-        PUT_8B(root, (size_t) NULL);
+#define PROF_ALLOC(bp, size) \
+    do { if ((prof_left -= (long) (size)) < 0) prof_record(bp, size); } while (0)
+#define PROF_FREE(bp) \
+    do { if (prof_filter[PROF_HASH(bp)] != 0) prof_move(bp, NULL, 0); } while (0)
+#define PROF_MOVE(old, bp, size) \
+    do { if (prof_filter[PROF_HASH(old)] != 0) prof_move(old, bp, size); } while (0)
+#else
+#define PROF_ALLOC(bp, size)
+#define PROF_FREE(bp)
+#define PROF_MOVE(old, bp, size)
+#endif
 
-    } else if (prev != NULL && next == NULL) {
-        // Case 2: Set next of previous to be NULL
-        SET_NEXTP(prev, (size_t) NULL);
+#ifdef TRACE
+/* A buffer of records of one thread, written to the trace as one chunk */
+typedef struct trace_buf {
+    struct trace_buf *next;      /* Next queued or free buffer */
+    struct trace_buf *all;       /* Next buffer mapped */
+    int state;                   /* TRACE_IDLE, .. */
+    unsigned int tid;            /* Chunk header: thread number, */
+    unsigned int len;            /* bytes of records */
+    unsigned long long start;    /* and clock the first record counts from */
+    unsigned char data[TRACE_BUF];
+} trace_buf_t;
 
-    } else if (prev == NULL && next != NULL){
-        /* Case 3: Set previous of next to be NULL,
-         root to be pointed to next */
-        SET_PREVP(next, (size_t) NULL);
-        PUT_8B(root, (size_t) next);
+enum { TRACE_IDLE, TRACE_RECORDING, TRACE_QUEUED, TRACE_WRITING };
 
-    } else { // prev != NULL && next != NULL
-        // Case 4: next and prev point to each other
-        SET_PREVP(next, (size_t) prev);
-        SET_NEXTP(prev, (size_t) next); 
-    }
+static int trace_on;                       /* Set when MM_TRACE was opened */
+static int trace_fd = -1;
+static trace_buf_t *trace_queue;           /* Full buffers, oldest first */
+static trace_buf_t **trace_queue_tail = &trace_queue;
+static trace_buf_t *trace_idle;            /* Buffers written out */
+static trace_buf_t *trace_all;             /* Every buffer mapped */
+static int trace_bufs;                     /* Buffers mapped */
+static int trace_writing;                  /* The writer is writing a buffer */
+static unsigned int trace_tids;            /* Threads that recorded */
+static unsigned long trace_dropped;        /* Records lost for want of a buffer */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects all of the above */
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;   /* Queue or trace_writing changed */
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;            /* Hands over the buffer of an exiting thread */
+static __thread trace_buf_t *trace_cur;    /* Buffer this thread records to */
+static __thread unsigned int trace_tid;    /* Thread number, 0 until the first record */
+static __thread unsigned long long trace_last; /* Clock of the last record in trace_cur */
+static __thread size_t trace_ptr;          /* Last pointer in trace_cur */
+static __thread int trace_busy;            /* Inside realloc or the recorder */
 
-}
+#define TRACE_OP(type, old, bp, size) \
+    do { if (trace_on && !trace_busy) trace_op(type, old, bp, size); } while (0)
+#else
+#define TRACE_OP(type, old, bp, size)
+#endif
 
-/* 
- * insert_to_free_list - insert block bp into segragated free list by size classes
- *                       Each size class is linked in ascending order
- */
-static void insert_to_free_list(void* bp) {
-    // Ensure bp is valid
-    if (bp == NULL)
-        return;
+#ifdef GUARD_PAGES
+/* Guarded blocks: slot i is pages 2i (payload at its end) and 2i + 1
+   (never accessible) of the region */
+static char *guard_base;           /* Region, reserved on first use */
+static char *guard_end;
+static unsigned int guard_carved;  /* Slots from here on were never used */
+static unsigned int guard_ring[GUARD_SLOTS]; /* Freed slots, oldest first */
+static unsigned int guard_head, guard_tail;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects all of the above */
+static __thread long guard_left;   /* Requests before the next guarded one */
+static __thread unsigned long guard_rand; /* xorshift state */
+#endif
 
-    // Prepare size of current bp and variable for next size
-    size_t size = GET_SIZE(HDRP(bp));
-    size_t next_size;
+#ifdef TCACHE
+/* Per-thread cache, bin i holds free blocks of size class i,
+   linked through the first word of their payload */
+struct tcache {
+    void *bins[TCACHE_CLASSES];
+    unsigned int counts[TCACHE_CLASSES];
+    size_t bytes;    /* Total size of cached blocks */
+    int registered;  /* Exit destructor is installed */
+};
+static __thread struct tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+#endif
 
-    // Prepare root, prev and next to find position of the block
-    void* root = get_root(size);
-    void* prev = root;
-    void* next = (void *) GET_8B(root);
-    
-    // Sorting to find position of current block
-    while (next != NULL) {
-        next_size = GET_SIZE(HDRP(next));
 
-        if (next_size >= size) 
-            break;
-        
-        prev = next;
-        next = (void*) GET_NEXTP(next);
-    }
+/* Function prototypes for internal helper routines */
+static void *extend_heap(arena_t *a, size_t words);
+static size_t grow_step(arena_t *a);
+static size_t grow_size(arena_t *a, size_t asize);
+static void* place(arena_t *a, void *bp, size_t asize);
+static void *find_fit(arena_t *a, size_t asize);
+static void *coalesce(arena_t *a, void *bp);
+static size_t adjust_size(size_t size);
+static void trim_top(arena_t *a, void *bp);
+#ifdef SCAVENGE
+static void scavenge_tick(arena_t *a);
+static size_t scavenge(arena_t *a, size_t budget, unsigned int age);
+static size_t scavenge_block(arena_t *a, void *bp, unsigned int age);
+#ifdef LARGE_TREE
+static size_t scavenge_tree(arena_t *a, void *t, size_t budget, unsigned int age);
+#endif
+#endif
+static void trim_block(arena_t *a, void *bp, size_t asize);
+static int heap_init(arena_t *a);
+static void* alloc_block(arena_t *a, size_t asize);
+static void* malloc_aligned_block(arena_t *a, size_t align, size_t asize);
+static void* arena_sbrk(arena_t *a, size_t incr);
+static arena_t* arena_of(void *bp);
+static arena_t* arena_get(void);
+#ifdef MULTI_ARENA
+static arena_t* arena_pick(void);
+static int arena_reserve(arena_t *a);
+#ifdef HUGETLB
+static int arena_commit(arena_t *a, size_t len);
+#endif
+#ifdef REMOTE_FREE
+static void remote_push(arena_t *a, void *bp);
+static void remote_drain(arena_t *a);
+static void sort_addr(void **p, size_t n);
+#endif
+#ifdef NUMA_ARENAS
+static void arena_bind(arena_t *a, void *p, size_t len);
+#endif
+#endif
+static void* heap_alloc(size_t size, int *zero);
+static void* heap_realloc(void *oldptr, size_t size);
+static void zero_fill(void *p, size_t n);
+static void* malloc_block(arena_t *a, size_t asize);
+static void free_block(arena_t *a, void *bp);
+static void free_heap_block(arena_t *a, void *bp);
+static void free_now(arena_t *a, void *bp);
+#ifndef NDEBUG
+static int size_fits(void *bp, size_t size);
+#endif
+static size_t carve_run(arena_t *a, size_t asize, void **ptrs, size_t n);
+static int cmp_addr(const void *x, const void *y);
+#ifdef FASTBINS
+static void fast_consolidate(arena_t *a);
+static void check_fastbins(check_t *c, arena_t *a);
+#endif
+static int resize_block(arena_t *a, void *bp, size_t asize, size_t want);
+static inline int place_at_end(arena_t *a, void *bp, size_t asize);
+#ifdef REALLOC_SLACK
+static void* grow_alloc(size_t size);
+static void mark_grown(arena_t *a, void *bp);
+#endif
 
-    // Proper insertion: similar 4 cases as remove_from_free_list
-    if (prev == root && next == NULL){
-        // Case 1: The only block
-        // Set pointer for root
-        PUT_8B(root, (size_t) bp);
+/* Function prototypes for manipulating segregated free list */
+static int get_class(size_t size);
+static size_t class_min_size(int i);
+static void* get_root(arena_t *a, int i);
+static void* class_first(arena_t *a, int i);
+static void set_class_bit(arena_t *a, int i);
+static void clear_class_bit(arena_t *a, int i);
+static void remove_from_free_list(arena_t *a, void *bp);
+static void insert_to_free_list(arena_t *a, void* bp);
 
-        dbg_printf("size of bp=%d\n", GET_SIZE(HDRP(bp)));
-        // Set pointers for bp
-        SET_PREVP(bp, (size_t) NULL);
-        SET_NEXTP(bp, (size_t) next);
+/* Function prototypes for the heap checker */
+static int in_heap(arena_t *a, const void *p);
+static int aligned(const void *p);
+static void check_error(check_t *c, int code, const void *bp, const char *msg);
+#ifdef HEAP_CHECK
+static void check_block(check_t *c, void *bp);
+static void check_op(void *bp);
+#endif
+static void verify_arena(check_t *c, arena_t *a, int level);
+#ifdef THREAD_SAFE
+static void* verify_thread(void *arg);
+static int verify_parallel(int level, mm_heap_error_t *err);
+#endif
 
-    } else if (prev != root && next == NULL) {
-        // Case 2: The last block
-        // Set pointers for bp 
-        SET_PREVP(bp, (size_t) prev);
-        SET_NEXTP(bp, (size_t) next);
+#ifdef STATS
+static void stat_heap(long delta);
+static int stat_class(void *bp);
+static void stat_request(size_t size, size_t asize);
+static void stats_dump(void);
+#endif
+static void analyze_arena(mm_analysis_t *an, arena_t *a);
+static void analyze_span(unsigned long *span, size_t len, size_t lo, size_t hi);
 
-        // Prev block points to bp as next
-        SET_NEXTP(prev, (size_t) bp);
+#ifdef PROFILE
+static void prof_record(void *bp, size_t size);
+static void prof_move(void *old, void *bp, size_t size);
+static long prof_next(void);
+static void prof_write(int fd, const char *buf, size_t len);
+static void prof_dump_at_exit(void);
+#endif
 
-    } else if (prev == root && next != NULL) {
-        // Case 3: The first block
-        // Set pointer for root
-        PUT_8B(root, (size_t) bp);
+#ifdef TRACE
+static unsigned long long trace_clock(void);
+static void trace_op(int type, void *old, void *bp, size_t size);
+static unsigned char* trace_varint(unsigned char *p, unsigned long long v);
+static unsigned char* trace_pointer(unsigned char *p, void *bp);
+static trace_buf_t* trace_swap(trace_buf_t *b, unsigned long long now);
+static void trace_queue_buf(trace_buf_t *b);
+static void trace_start(void);
+static void* trace_writer(void *arg);
+static void trace_write(trace_buf_t *b);
+static void trace_thread_exit(void *arg);
+static void trace_child(void);
+static void trace_open(void);
+static void trace_close(void);
+#endif
 
-        // Set pointers for bp
-        SET_PREVP(bp, (size_t) NULL);
-        SET_NEXTP(bp, (size_t) next);
+#ifdef HARDENED
+static void harden_init(void);
+static void harden_check(void *bp);
+static int harden_cached(arena_t *a, void *bp);
+static void harden_abort(const char *msg, void *bp);
+#endif
+#ifdef GUARD_PAGES
+static int is_guarded(void *bp);
+static void* guard_alloc(size_t size);
+static void guard_free(void *bp);
+static size_t guard_size(void *bp);
+#endif
 
-        // Next block points to bp as previous
+#ifdef TCACHE
+/* Function prototypes for the per-thread cache */
+static void* tcache_get(size_t asize);
+static int tcache_put(void *bp, size_t size);
+static void tcache_flush(struct tcache *tc, int i, unsigned int n);
+static void tcache_register(void);
+static void tcache_make_key(void);
+static void tcache_destroy(void *arg);
+#endif
+#if defined(TCACHE) || !defined(NDEBUG)
+static size_t payload_size(void *bp);
+#endif
+
+#ifdef MMAP_HUGE
+static int is_mmapped(void *bp);
+static void* mmap_alloc(size_t size);
+static void* mmap_resize(void *bp, size_t size);
+static void mmap_free(void *bp);
+#endif
+
+#ifdef SLABS
+static char* slab_origin(arena_t *a);
+static slab_t* slab_of(arena_t *a, void *bp);
+static void slab_mark(arena_t *a, slab_t *s, int on);
+static void slab_link(arena_t *a, slab_t *s);
+static void slab_unlink(arena_t *a, slab_t *s);
+static slab_t* slab_create(arena_t *a, int c);
+static void* slab_alloc(arena_t *a, int c);
+static void slab_free(arena_t *a, slab_t *s, void *bp);
+static void check_slabs(check_t *c, arena_t *a);
+#endif
+
+#ifdef LARGE_TREE
+/* Function prototypes for the treap holding the last size class */
+static int tree_less(void* a, void* b);
+static size_t tree_prio(void* bp);
+static void* tree_insert(void* t, void* bp);
+static void* tree_merge(void* l, void* r);
+static void* tree_remove(void* t, void* bp);
+static void* tree_best_fit(void* t, size_t asize);
+static size_t check_tree(check_t *c, arena_t *a, void* t, size_t min, size_t max);
+#endif
+
+
+/*
+* get_class - Given a size, get the index of its size class
+*             Class index = group * SL_COUNT + subclass
+*             Group 0: sizes < 2^FL_MIN_LOG2, subclass is size / 8
+*             Group g: sizes in [2^(g+FL_MIN_LOG2-1), 2^(g+FL_MIN_LOG2)),
+*                      split into SL_COUNT equal subclasses
+*             Last class: sizes >= 2^FL_MAX_LOG2
+*/
+static int get_class(size_t size) {
+    int i;
+    if (size >= ((size_t) 1 << FL_MAX_LOG2)) {
+        i = NUM_CLASSES-1;
+    } else if (size < (1 << FL_MIN_LOG2)) {
+        i = (int) (size >> 3);
+    } else {
+        // fl = floor(log2(size)), sl = the SL_LOG2 bits below the leading bit
+        int fl = (int)(8*sizeof(size_t)) - 1 - __builtin_clzl(size);
+        int sl = (int) (size >> (fl - SL_LOG2)) - SL_COUNT;
+        i = ((fl - FL_MIN_LOG2 + 1) << SL_LOG2) + sl;
+    }
+    dbg_printf("get_class: i=%d size=%zu\n", i, size);
+    return i;
+}
+
+/*
+* class_min_size - Smallest block size that belongs to class i,
+*                  class i holds [class_min_size(i), class_min_size(i+1))
+*/
+static size_t class_min_size(int i) {
+    int g = i >> SL_LOG2;
+    int sl = i & (SL_COUNT - 1);
+    if (g == 0)
+        return (size_t) sl << 3;
+    if (g == FL_COUNT)
+        return (size_t) 1 << FL_MAX_LOG2;
+    int fl = g + FL_MIN_LOG2 - 1;
+    return ((size_t) 1 << fl) + ((size_t) sl << (fl - SL_LOG2));
+}
+
+/*
+* set_class_bit - Mark class i as non-empty in both bitmap levels
+*/
+static void set_class_bit(arena_t *a, int i) {
+    a->sl_bitmap[i >> SL_LOG2] |= 1u << (i & (SL_COUNT - 1));
+    a->fl_bitmap |= (size_t) 1 << (i >> SL_LOG2);
+}
+
+/*
+* clear_class_bit - Mark class i as empty, and its group if it was the last
+*/
+static void clear_class_bit(arena_t *a, int i) {
+    int g = i >> SL_LOG2;
+    a->sl_bitmap[g] &= ~(1u << (i & (SL_COUNT - 1)));
+    if (a->sl_bitmap[g] == 0)
+        a->fl_bitmap &= ~((size_t) 1 << g);
+}
+
+/*
+* get_root - Given a size class, get the address of the start of its free list
+*/
+static void* get_root(arena_t *a, int i) {
+    return a->seg_free_listp + (i*DSIZE);
+}
+
+/*
+* class_first - Given a non-empty size class, get its smallest block
+*               (any block of the class under LIFO_LISTS)
+*/
+static void* class_first(arena_t *a, int i) {
+    void* bp = (void*) GET_8B(get_root(a, i));
+#ifdef LARGE_TREE
+    if (i == NUM_CLASSES-1) {
+        // Leftmost node of the treap
+        while (GET_PREVP(bp) != (size_t) NULL)
+            bp = (void*) GET_PREVP(bp);
+    }
+#endif
+    return bp;
+}
+
+#ifdef LARGE_TREE
+/*
+ * The last size class is a treap: a binary search tree on (size, address)
+ * that is also a max-heap on a hash of the address, which keeps it balanced
+ * in expectation. Left child is stored in the prev pointer space,
+ * right child in the next pointer space. 
+ */
+#define TREE_LEFT(bp)          ((void*) GET_PREVP(bp))
+#define TREE_RIGHT(bp)         ((void*) GET_NEXTP(bp))
+#define SET_TREE_LEFT(bp, l)   SET_PREVP(bp, (size_t) (l))
+#define SET_TREE_RIGHT(bp, r)  SET_NEXTP(bp, (size_t) (r))
+
+/*
+ * tree_less - Order of the treap: by size, equal sizes by address
+ */
+static int tree_less(void* a, void* b) {
+    size_t a_size = NODE_SIZE(a);
+    size_t b_size = NODE_SIZE(b);
+    return a_size < b_size || (a_size == b_size && a < b);
+}
+
+/*
+ * tree_prio - Heap priority of a node, a multiplicative hash of its address
+ */
+static size_t tree_prio(void* bp) {
+    return ((size_t) bp >> 3) * (size_t) 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * tree_insert - Insert bp into the treap rooted at t, return the new root
+ */
+static void* tree_insert(void* t, void* bp) {
+    void* child;
+    if (t == NULL) {
+        SET_TREE_LEFT(bp, NULL);
+        SET_TREE_RIGHT(bp, NULL);
+        return bp;
+    }
+
+    if (tree_less(bp, t)) {
+        child = tree_insert(TREE_LEFT(t), bp);
+        SET_TREE_LEFT(t, child);
+        if (tree_prio(child) > tree_prio(t)) {
+            // Rotate right
+            SET_TREE_LEFT(t, TREE_RIGHT(child));
+            SET_TREE_RIGHT(child, t);
+            return child;
+        }
+    } else {
+        child = tree_insert(TREE_RIGHT(t), bp);
+        SET_TREE_RIGHT(t, child);
+        if (tree_prio(child) > tree_prio(t)) {
+            // Rotate left
+            SET_TREE_RIGHT(t, TREE_LEFT(child));
+            SET_TREE_LEFT(child, t);
+            return child;
+        }
+    }
+    return t;
+}
+
+/*
+ * tree_merge - Join treaps l and r, every key in l is less than in r
+ */
+static void* tree_merge(void* l, void* r) {
+    if (l == NULL)
+        return r;
+    if (r == NULL)
+        return l;
+
+    if (tree_prio(l) > tree_prio(r)) {
+        SET_TREE_RIGHT(l, tree_merge(TREE_RIGHT(l), r));
+        return l;
+    }
+    SET_TREE_LEFT(r, tree_merge(l, TREE_LEFT(r)));
+    return r;
+}
+
+/*
+ * tree_remove - Remove bp from the treap rooted at t, return the new root
+ */
+static void* tree_remove(void* t, void* bp) {
+    if (t == bp) {
+        t = tree_merge(TREE_LEFT(bp), TREE_RIGHT(bp));
+        SET_TREE_LEFT(bp, NULL);
+        SET_TREE_RIGHT(bp, NULL);
+        return t;
+    }
+
+    if (tree_less(bp, t))
+        SET_TREE_LEFT(t, tree_remove(TREE_LEFT(t), bp));
+    else
+        SET_TREE_RIGHT(t, tree_remove(TREE_RIGHT(t), bp));
+    return t;
+}
+
+/*
+ * tree_best_fit - Smallest block of at least asize bytes in the treap
+ */
+static void* tree_best_fit(void* t, size_t asize) {
+    void* fit = NULL;
+    while (t != NULL) {
+        if (NODE_SIZE(t) >= asize) {
+            // Fits, but a smaller one may be on the left
+            fit = t;
+            t = TREE_LEFT(t);
+        } else {
+            t = TREE_RIGHT(t);
+        }
+    }
+    return fit;
+}
+#endif /* LARGE_TREE */
+
+/*
+ * remove_from_free_list - remove the block from the segregated free list
+                            Link the blocks from left and right
+                            Take note: 4 cases on where the block could be removed from
+                            Case 1: Prev block is root, next block is NULL
+                            Case 2: Prev block is not root, next block is NULL
+                            Case 3: Prev block is root, next block is not NUll
+                            Case 4: Prev block is not root, next block is not NULL
+ */ 
+static void remove_from_free_list(arena_t *a, void *bp) {
+    // Make sure bp is valid to be removed from the list
+    if (bp == NULL || GET_ALLOC(HDRP(bp)))
+        return;
+
+    // Get the block's root, prev and next
+    int i = get_class(GET_SIZE(HDRP(bp)));
+    void *root = get_root(a, i);
+
+#ifdef LARGE_TREE
+    if (i == NUM_CLASSES-1) {
+        PUT_8B(root, (size_t) tree_remove((void*) GET_8B(root), bp));
+        if (GET_8B(root) == (size_t) NULL)
+            clear_class_bit(a, i);
+        return;
+    }
+#endif
+
+    void* prev = (void*) GET_PREVP(bp);
+    void* next = (void*) GET_NEXTP(bp);
+
+#ifdef HARDENED
+    // The neighbours have to point back at bp
+    if ((prev != NULL ? (void*) GET_NEXTP(prev) : (void*) GET_8B(root)) != bp ||
+        (next != NULL && (void*) GET_PREVP(next) != bp))
+        harden_abort("corrupted free list", bp);
+#endif
+
+    // Sever the block from the free list first
+    SET_PREVP(bp, (size_t) NULL);
+    SET_NEXTP(bp, (size_t) NULL);
+
+    if (prev == NULL && next == NULL) { 
+        // Case 1: Set root to NULL, the class is now empty
+        PUT_8B(root, (size_t) NULL);
+        clear_class_bit(a, i);
+
+    } else if (prev != NULL && next == NULL) {
+        // Case 2: Set next of previous to be NULL
+        SET_NEXTP(prev, (size_t) NULL);
+
+    } else if (prev == NULL && next != NULL){
+        /* Case 3: Set previous of next to be NULL,
+         root to be pointed to next */
+        SET_PREVP(next, (size_t) NULL);
+        PUT_8B(root, (size_t) next);
+
+    } else { // prev != NULL && next != NULL
+        // Case 4: next and prev point to each other
+        SET_PREVP(next, (size_t) prev);
+        SET_NEXTP(prev, (size_t) next); 
+    }
+
+}
+
+/* 
+ * insert_to_free_list - insert block bp into segragated free list by size classes
+ *                       Each size class is linked in ascending order
+ *                       (pushed to the front under LIFO_LISTS)
+ */
+static void insert_to_free_list(arena_t *a, void* bp) {
+    // Ensure bp is valid
+    if (bp == NULL)
+        return;
+
+    // Prepare size of current bp and variable for next size
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t next_size;
+
+    // Prepare root, prev and next to find position of the block
+    int i = get_class(size);
+    void* root = get_root(a, i);
+    void* prev = root;
+    void* next = (void *) GET_8B(root);
+
+    // The class is non-empty from now on
+    set_class_bit(a, i);
+    STAT_ADD(insert_calls, 1);
+    SET_NODE_SIZE(bp, size);
+
+#ifdef LARGE_TREE
+    if (i == NUM_CLASSES-1) {
+        PUT_8B(root, (size_t) tree_insert(next, bp));
+        return;
+    }
+#endif
+    
+#ifndef LIFO_LISTS
+    // Sorting to find position of current block
+    while (next != NULL) {
+        PREFETCH(GET_NEXTP(next));
+        next_size = NODE_SIZE(next);
+
+        if (next_size > size) 
+            break;
+#ifdef SPLIT_ENDS
+        // Equal sizes in address order
+        if (next_size == size && (char*) next > (char*) bp)
+            break;
+#else
+        if (next_size == size)
+            break;
+#endif
+        
+        prev = next;
+        next = (void*) GET_NEXTP(next);
+        STAT_ADD(insert_walk, 1);
+    }
+#else
+    (void) next_size; // Front of the class: prev is root, next is head
+#endif
+
+    // Proper insertion: similar 4 cases as remove_from_free_list
+    if (prev == root && next == NULL){
+        // Case 1: The only block
+        // Set pointer for root
+        PUT_8B(root, (size_t) bp);
+
+        dbg_printf("size of bp=%d\n", GET_SIZE(HDRP(bp)));
+        // Set pointers for bp
+        SET_PREVP(bp, (size_t) NULL);
+        SET_NEXTP(bp, (size_t) next);
+
+    } else if (prev != root && next == NULL) {
+        // Case 2: The last block
+        // Set pointers for bp 
+        SET_PREVP(bp, (size_t) prev);
+        SET_NEXTP(bp, (size_t) next);
+
+        // Prev block points to bp as next
+        SET_NEXTP(prev, (size_t) bp);
+
+    } else if (prev == root && next != NULL) {
+        // Case 3: The first block
+        // Set pointer for root
+        PUT_8B(root, (size_t) bp);
+
+        // Set pointers for bp
+        SET_PREVP(bp, (size_t) NULL);
+        SET_NEXTP(bp, (size_t) next);
+
+        // Next block points to bp as previous
         SET_PREVP(next, (size_t) bp);
 
     } else { // prev != root && next != NULL
@@ -251,16 +1435,36 @@ static void insert_to_free_list(void* bp) {
 /*
  * extend_heap - extend heap with a new free block = words * WSIZE
  */
-static void* extend_heap(size_t words) {
+static void* extend_heap(arena_t *a, size_t words) {
     char* bp;
     size_t size;
+    char* fresh = a->fresh;
+    int zero;
 
     dbg_printf("Entered extend_heap\n");
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    /* Allocate a multiple of ALIGNMENT to maintain alignment */
+    size = ALIGN(words * WSIZE);
+#ifdef HUGE_PAGES
+    // End the heap on a huge page boundary, so that its pages can be huge;
+    // the break is ALIGNMENT aligned, hence so is the padding
+    size_t end = (size_t) arena_sbrk(a, 0) + size;
+    size_t pad = (HUGE_PAGE - end % HUGE_PAGE) % HUGE_PAGE;
+    if ((long)(bp = arena_sbrk(a, size + pad)) != -1)
+        size += pad;
+    else
+#endif
+    if ((long)(bp = arena_sbrk(a, size)) == -1)
         return NULL;
+    STAT_ADD(extend_calls, 1);
+    STAT_ADD(extend_bytes, size);
+
+    // Memory past the highest break so far is zero, if it comes from mmap
+#ifdef MEMLIB_ZEROED
+    zero = (bp >= fresh);
+#else
+    zero = (a->id != 0 && bp >= fresh);
+#endif
 
     /* Initialize free block header/footer and the epilogue header */
     PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) )); // Free block's header, copy prev_alloc
@@ -271,8 +1475,54 @@ static void* extend_heap(size_t words) {
     SET_PREVP(bp, (size_t) NULL); 
     SET_NEXTP(bp, (size_t) NULL);
 
-    return coalesce(bp); // coalesce if the previous block is free.
+    // A known zero block before stays known zero with the new memory once the
+    // old footer and epilogue, now inside the merged block, are cleared
+    char *old = bp;
+    if (zero && !GET_PREV_ALLOC(HDRP(bp)) && !GET_ZERO(PREV_FTRP(bp)))
+        zero = 0;
+
+    bp = coalesce(a, bp); // coalesce if the previous block is free.
     // Block will be inserted into free list after coalescing
+
+    if (zero) {
+        if (bp != old) {
+            PUT_8B(PREV_FTRP(old), 0);
+            memset(old, 0, NODESIZE); // Its links, masked NULL is not 0
+        }
+#ifdef SCAVENGE
+        if (GET_SIZE(HDRP(bp)) >= SCAVENGE_MIN)
+            SET_STAMP(bp, 0); // Stamped by coalesce
+#endif
+        PUT(HDRP(bp), GET(HDRP(bp)) | 0x4);
+        PUT(FTRP(bp), GET(HDRP(bp)));
+    }
+    return bp;
+}
+
+/*
+ * grow_step - Least amount to grow the heap of arena a by: a 1/2^GROW_SHIFT
+ *             fraction of its size, within [CHUNKSIZE, GROW_MAX]
+ */
+static size_t grow_step(arena_t *a) {
+    size_t heap = (char*) arena_sbrk(a, 0) - a->seg_free_listp;
+    return ALIGN(MIN(MAX(heap >> GROW_SHIFT, CHUNKSIZE), GROW_MAX));
+}
+
+/*
+ * grow_size - Bytes to extend the heap of arena a by to fit a block of
+ *             asize bytes. Only the shortfall if the last block is free,
+ *             as extend_heap coalesces it with the new space
+ */
+static size_t grow_size(arena_t *a, size_t asize) {
+    char *end = arena_sbrk(a, 0);
+
+    // The epilogue tells whether the last block is free
+    if (!GET_PREV_ALLOC(end - WSIZE)) {
+        size_t top = GET_SIZE(end - DSIZE);
+        if (top < asize)
+            return MAX(asize - top, MINBLOCKSIZE);
+    }
+    return MAX(asize, grow_step(a));
 }
 
 /* coalesce -  Return pointer to coalesced block, folows 4 cases frm textbook
@@ -281,7 +1531,7 @@ static void* extend_heap(size_t words) {
             Free blocks are removed from the free list, 
             final big free block is then inserted into free list
 */
-static void* coalesce(void *bp) {
+static void* coalesce(arena_t *a, void *bp) {
     dbg_printf("Start of coalesce\n");
     size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
@@ -292,12 +1542,14 @@ static void* coalesce(void *bp) {
     void* next_bp = NEXT_BLKP(bp);
 
     if (prev_alloc && next_alloc) { // Case 1
+        STAT_ADD(coalesce[0], 1);
 
         // Nothing to be done, ready to insert and return
 
     } else if (prev_alloc && !next_alloc) { // Case 2: Next block is free
+        STAT_ADD(coalesce[1], 1);
         // Remove next block from free list
-        remove_from_free_list(next_bp);
+        remove_from_free_list(a, next_bp);
 
         // Get size of next block
         size_t next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
@@ -307,8 +1559,9 @@ static void* coalesce(void *bp) {
         PUT(FTRP(bp), GET(HDRP(bp))); 
 
     } else if (!prev_alloc && next_alloc) { // Case 3: Prev block is free
+        STAT_ADD(coalesce[2], 1);
         // Remove previous block from free list
-        remove_from_free_list(prev_bp);
+        remove_from_free_list(a, prev_bp);
 
         // Get size of prev block
         size_t prev_size = GET_SIZE(HDRP(prev_bp));
@@ -323,9 +1576,10 @@ static void* coalesce(void *bp) {
         PUT(FTRP(bp), GET(HDRP(bp)) ); // footer copies from header
 
     } else { // Case 4: Both prev and next blocks are free
+        STAT_ADD(coalesce[3], 1);
         // Remove both from free list
-        remove_from_free_list(prev_bp);
-        remove_from_free_list(next_bp);
+        remove_from_free_list(a, prev_bp);
+        remove_from_free_list(a, next_bp);
         
         // Get sizes
         size_t prev_size = GET_SIZE(HDRP(prev_bp));
@@ -341,392 +1595,3406 @@ static void* coalesce(void *bp) {
         PUT(FTRP(prev_bp), GET(HDRP(bp)) );
     }
 
-    // Finally, insert the coalesced block into free list
-    insert_to_free_list(bp);
-    dbg_printf("End of coalesce\n");
-    //mm_checkheap(__LINE__);
-    return bp; // Returns pointer to coalesced block
+#ifdef SCAVENGE
+    if (size >= SCAVENGE_MIN)
+        SET_STAMP(bp, a->scav_epoch);
+#endif
+    // Finally, insert the coalesced block into free list
+    insert_to_free_list(a, bp);
+    dbg_printf("End of coalesce\n");
+    //mm_checkheap(__LINE__);
+    return bp; // Returns pointer to coalesced block
+}
+
+/*
+ * arena_sbrk - Extend the heap of arena a by incr bytes, same contract as mem_sbrk
+ *              mmap arenas make their region read/write ARENA_COMMIT bytes
+ *              at a time as the heap grows into it
+ */
+static void* arena_sbrk(arena_t *a, size_t incr) {
+    char *old;
+
+    if (a->id == 0) {
+        if ((old = mem_sbrk(incr)) == (void*) -1)
+            return old;
+#ifdef HUGE_PAGES
+        if (incr > 0) {
+            size_t page = mem_pagesize();
+            char *lo = (char*) ((size_t) old & ~(page - 1));
+            madvise(lo, old + incr - lo, MADV_HUGEPAGE);
+        }
+#endif
+    } else {
+#ifdef MULTI_ARENA
+        old = a->brk;
+        if (incr > (size_t) (a->base + ARENA_SIZE - a->brk))
+            return (void*) -1;
+
+        if (a->brk + incr > a->committed) {
+            size_t len = (a->brk + incr - a->committed + ARENA_COMMIT - 1) & ~(ARENA_COMMIT - 1);
+            if (len > (size_t) (a->base + ARENA_SIZE - a->committed))
+                len = a->base + ARENA_SIZE - a->committed;
+#ifdef HUGETLB
+            if (arena_commit(a, len) != 0)
+#else
+            if (mprotect(a->committed, len, PROT_READ | PROT_WRITE) != 0)
+#endif
+                return (void*) -1;
+            a->committed += len;
+        }
+        a->brk += incr;
+#else
+        return (void*) -1;
+#endif
+    }
+
+    if (old + incr > a->fresh)
+        a->fresh = old + incr;
+#ifdef STATS
+    a->heap_bytes += incr;
+#endif
+    STAT_HEAP(incr);
+    return old;
+}
+
+/*
+ * arena_of - Arena that block bp belongs to: the mem_sbrk heap, or else the
+ *            ARENA_SIZE aligned region around bp, which starts with a
+ *            pointer to its arena
+ */
+static arena_t* arena_of(void *bp) {
+#ifdef MULTI_ARENA
+    if ((char*) bp < (char*) mem_heap_lo() || (char*) bp > (char*) mem_heap_hi())
+        return (arena_t*) GET_8B((size_t) bp & ~(ARENA_SIZE - 1));
+#else
+    (void) bp;
+#endif
+    return &arenas[0];
+}
+
+/*
+ * arena_get - Arena used by this thread for new blocks
+ */
+static arena_t* arena_get(void) {
+#ifdef MULTI_ARENA
+    arena_t *a = thread_arena;
+    if (a == NULL)
+        a = thread_arena = arena_pick();
+    return a;
+#else
+    return &arenas[0];
+#endif
+}
+
+#ifdef MULTI_ARENA
+/*
+ * arena_pick - Bind the calling thread to the arena of its CPU, round robin
+ *              if the CPU is unknown. The arena is created on first use;
+ *              with as many arenas as CPUs, one per CPU
+ */
+static arena_t* arena_pick(void) {
+    int id, cpu;
+    arena_t *a;
+
+    pthread_mutex_lock(&arenas_lock);
+    if (narenas == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        narenas = (ncpus < 1) ? 1 : (ncpus > MAX_ARENAS + 1) ? MAX_ARENAS + 1 : (int) ncpus;
+    }
+
+    cpu = sched_getcpu();
+    if (cpu < 0)
+        cpu = (int) (arena_next++);
+    id = cpu % narenas;
+
+    a = &arenas[id];
+    if (id != 0 && a->base == NULL && arena_reserve(a) < 0)
+        a = &arenas[0]; // Out of address space, share the mem_sbrk heap
+    pthread_mutex_unlock(&arenas_lock);
+    return a;
+}
+
+/*
+ * arena_reserve - Reserve the ARENA_SIZE aligned region of arena a,
+ *                 arenas_lock held. Pages are inaccessible until arena_sbrk
+ */
+static int arena_reserve(arena_t *a) {
+    char *p = mmap(NULL, 2*ARENA_SIZE, PROT_NONE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return -1;
+
+    // Keep the aligned middle, give back the ends
+    char *base = (char*) (((size_t) p + ARENA_SIZE - 1) & ~(ARENA_SIZE - 1));
+    if (base > p)
+        munmap(p, base - p);
+    munmap(base + ARENA_SIZE, p + ARENA_SIZE - base);
+
+    a->id = (int) (a - arenas);
+    a->base = a->brk = a->committed = a->fresh = base;
+    a->heap_listp = 0;
+#ifdef HUGE_PAGES
+    madvise(base, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+#ifdef NUMA_ARENAS
+    // The calling thread is the first one to allocate here
+    unsigned int cpu, node;
+    a->node = (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) ? (int) node : -1;
+    arena_bind(a, base, ARENA_SIZE);
+#endif
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+}
+
+#ifdef HUGETLB
+/*
+ * arena_commit - Make the len bytes of the region of arena a past committed
+ *                read/write, with explicit huge pages if the pool has them.
+ *                The new mapping replaces the reserved one, which comes
+ *                back as small (transparent huge) pages if the huge page
+ *                mapping fails
+ */
+static int arena_commit(arena_t *a, size_t len) {
+    char *p = mmap(a->committed, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+        p = mmap(a->committed, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return -1;
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+#ifdef NUMA_ARENAS
+    // A new mapping does not keep the policy of the one it replaced
+    arena_bind(a, p, len);
+#endif
+    return 0;
+}
+#endif
+
+#ifdef NUMA_ARENAS
+/*
+ * arena_bind - Prefer the NUMA node of arena a for the pages in [p, p+len),
+ *              if the node is known
+ */
+static void arena_bind(arena_t *a, void *p, size_t len) {
+    unsigned long mask;
+
+    if (a->node < 0 || a->node >= (int) (8 * sizeof(mask)))
+        return;
+    mask = 1UL << a->node;
+    // The kernel reads maxnode - 1 bits of the mask
+    syscall(SYS_mbind, p, len, MPOL_PREFERRED, &mask, 8 * sizeof(mask) + 1, 0);
+}
+#endif
+#endif /* MULTI_ARENA */
+
+/*
+ * Initialize - return -1 on error, 0 on success. Creates NUM_CLASSES*(8 bytes)
+ *               spaces to hold the addresses of the start of each class size
+ *              Final two 8 byte blocks are split into 4 bytes: 
+ *              |--Alignment padding--|---Prologue Header---|
+ *              |---Prologue Footer---|---Epilogue Header---|
+ *              Heap list starts right after prologue header
+ */
+int mm_init(void) {
+    int ret;
+    arena_t *a = &arenas[0];
+    LOCK(a);
+    ret = heap_init(a);
+    UNLOCK(a);
+#ifdef MULTI_ARENA
+    // Other arenas start over on their next use
+    int i;
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 1; i <= MAX_ARENAS; i++) {
+        if (arenas[i].base == NULL)
+            continue;
+        LOCK(&arenas[i]);
+        arenas[i].heap_listp = 0;
+        UNLOCK(&arenas[i]);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+#endif
+#ifdef TCACHE
+    // Blocks cached by this thread belonged to the old heap
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.counts, 0, sizeof(tcache.counts));
+    tcache.bytes = 0;
+#endif
+    return ret;
+}
+
+/*
+ * heap_init - Lay out the heap of arena a, lock of a held
+ *             mmap arenas keep a pointer to their arena_t in the first
+ *             8 bytes of their region, in front of the root table
+ *             (and of the padding that aligns the first block)
+ */
+static int heap_init(arena_t *a) {
+    int i;
+    size_t hdr = (a->id == 0) ? 0 : DSIZE;
+    char *start;
+
+    a->brk = a->base;
+#ifdef HARDENED
+    harden_init();
+#endif
+#ifdef STATS
+    // The old heap, if any, is gone
+    STAT_HEAP(-(long) a->heap_bytes);
+    a->heap_bytes = 0;
+#endif
+    // Pad the front so that the first payload is ALIGNMENT aligned
+    start = arena_sbrk(a, 0);
+    hdr += (ALIGNMENT - ((size_t) start + hdr + (NUM_CLASSES + 2)*DSIZE) % ALIGNMENT) % ALIGNMENT;
+    if ((a->heap_listp = arena_sbrk(a, hdr + (NUM_CLASSES + 2)*DSIZE)) == (void*)-1) {
+        a->heap_listp = 0; // Retried on the next malloc
+        return -1;
+    }
+    if (hdr != 0) {
+        PUT_8B(a->heap_listp, (size_t) a);
+        a->heap_listp += hdr;
+    }
+    
+    // Create segregated free list, class i holds sizes [class_min_size(i), class_min_size(i+1))
+    for (i = 0; i < NUM_CLASSES; i++)
+        PUT_8B(a->heap_listp + (i*DSIZE), (size_t) NULL);
+    
+    // Alignement padding
+    PUT(a->heap_listp + (NUM_CLASSES*DSIZE), 0); 
+    // Prologue header
+    PUT(a->heap_listp + (NUM_CLASSES*DSIZE + WSIZE), PACK(DSIZE, 0b01)); 
+    // Prologue footer, heaplist starts here
+    PUT(a->heap_listp + ((NUM_CLASSES + 1)*DSIZE), PACK(DSIZE, 0b01)); 
+    // Epilogue header
+    PUT(a->heap_listp + ((NUM_CLASSES + 1)*DSIZE + WSIZE), PACK(0, 0b11)); 
+
+    a->seg_free_listp = a->heap_listp;
+    a->dirty_end = NULL;
+#ifdef FASTBINS
+    memset(a->fastbins, 0, sizeof(a->fastbins));
+    a->fast_bytes = 0;
+#endif
+    a->fl_bitmap = 0;
+    memset(a->sl_bitmap, 0, sizeof(a->sl_bitmap));
+#ifdef REALLOC_SLACK
+    memset(a->grow_tails, 0, sizeof(a->grow_tails));
+#endif
+#ifdef REMOTE_FREE
+    // Blocks queued for the old heap are gone with it
+    __atomic_store_n(&a->remote, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&a->remote_count, 0, __ATOMIC_RELAXED);
+#endif
+#ifdef SLABS
+    memset(a->slabs, 0, sizeof(a->slabs));
+    memset(a->slab_map, 0, a->slab_words * sizeof(a->slab_map[0]));
+    a->slab_words = 0;
+#endif
+    a->heap_listp += ((NUM_CLASSES + 1) * DSIZE);
+
+    /* Extend the empty heap with a free block of INIT_HEAP bytes */
+    if (extend_heap(a, MAX(INIT_HEAP, MINBLOCKSIZE)/WSIZE) == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * malloc - Allocate a block with at least size bytes of payload
+ */
+void *malloc (size_t size) {
+    void *bp = heap_alloc(size, NULL);
+    CHECK_OP(bp);
+    PROF_ALLOC(bp, size);
+    TRACE_OP(TRACE_MALLOC, NULL, bp, size);
+    return bp;
+}
+
+/*
+ * heap_alloc - malloc, also used by calloc as gcc turns malloc followed by
+ *              memset into a call to calloc.
+ *              If zero is not NULL, *zero is set if the block comes from a
+ *              known zero block (or from mmap, then it is all zero)
+ */
+static void* heap_alloc(size_t size, int *zero) {
+    size_t asize;      /* Adjusted block size */
+    char *bp;      
+
+    if (zero != NULL)
+        *zero = 0;
+
+    /* Ignore spurious requests */
+    if (size == 0)
+        return NULL;
+
+#ifdef MMAP_HUGE
+    if (size >= MMAP_THRESHOLD) {
+        if (zero != NULL)
+            *zero = 1;
+        return mmap_alloc(size);
+    }
+#endif
+#ifdef GUARD_PAGES
+    // A guarded page is fresh or was given back when freed, so it is zero
+    if (size <= GUARD_MAX && --guard_left < 0 && (bp = guard_alloc(size)) != NULL) {
+        if (zero != NULL)
+            *zero = 1;
+        return bp;
+    }
+#endif
+
+    /* Adjust block size to include overhead and alignment reqs. */
+#ifdef SLABS
+    if (size <= SLAB_MAX)
+        asize = SLAB_SLOT(SLAB_CLASS(size)); // Slot, no header
+    else
+#endif
+    asize = adjust_size(size);
+#ifdef STATS
+    stat_request(size, asize);
+#endif
+
+#ifdef TCACHE
+    if ((bp = tcache_get(asize)) != NULL) {
+        STAT_BLOCK(malloc_count, bp);
+        return bp;
+    }
+#endif
+
+    arena_t *a = arena_get();
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    a->placed_zero = 0;
+    bp = alloc_block(a, asize);
+    if (zero != NULL)
+        *zero = a->placed_zero;
+    UNLOCK(a);
+    STAT_BLOCK(malloc_count, bp);
+    return bp;
+}
+
+/*
+ * alloc_block - Allocate asize bytes in arena a, lock of a held:
+ *               a slot if asize is a slot size, a heap block otherwise
+ */
+static void* alloc_block(arena_t *a, size_t asize) {
+#ifdef SLABS
+    if (asize <= SLAB_MAX) {
+        void *bp;
+        if (a->heap_listp == 0 && heap_init(a) < 0)
+            return NULL;
+        if ((bp = slab_alloc(a, SLAB_CLASS(asize))) != NULL) {
+            a->placed_zero = 0; // Only the slab block was placed
+            return bp;
+        }
+        // No room for a new slab, a heap block may still fit
+        asize = adjust_size(asize);
+    }
+#endif
+    return malloc_block(a, asize);
+}
+
+/*
+ * malloc_block - Allocate a block of asize bytes in arena a, lock of a held
+ */
+static void* malloc_block(arena_t *a, size_t asize) {
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;      
+
+    if (a->heap_listp == 0){
+        if (heap_init(a) < 0)
+            return NULL;
+    }
+
+#ifdef FASTBINS
+    // A deferred free of the same size is taken as it is
+    if (asize < FAST_MAX && (bp = a->fastbins[asize / DSIZE]) != NULL) {
+        a->fastbins[asize / DSIZE] = GET_LINK(bp);
+        a->fast_bytes -= asize;
+        CLEAR_KEY(bp, asize);
+        return bp;
+    }
+#endif
+
+    /* Search the free list for a fit */
+    if ((bp = find_fit(a, asize)) != NULL)
+        return place(a, bp, asize);
+
+#ifdef FASTBINS
+    // Merge the deferred frees before growing the heap
+    if (a->fast_bytes > 0) {
+        fast_consolidate(a);
+        if ((bp = find_fit(a, asize)) != NULL)
+            return place(a, bp, asize);
+    }
+#endif
+
+    /* No fit found. Get more memory and place the block */
+    extendsize = grow_size(a, asize);
+    if ((bp = extend_heap(a, extendsize/WSIZE)) == NULL)  
+        return NULL;                                  
+    return place(a, bp, asize);
+}
+
+/*
+ * malloc_aligned_block - Allocate a block of asize bytes whose payload is
+ *                        aligned to align, a power of two, lock of a held
+ *                        The unaligned front is split off and freed
+ */
+static void* malloc_aligned_block(arena_t *a, size_t align, size_t asize) {
+    char *bp, *abp;
+
+    if ((bp = malloc_block(a, asize + align + MINBLOCKSIZE)) == NULL)
+        return NULL;
+
+    abp = (char*) (((size_t) bp + align - 1) & ~(align - 1));
+    if (abp != bp) {
+        // The front must be large enough to be a free block; align may be
+        // below MINBLOCKSIZE (SIZE_IN_NODE), the request leaves room for it
+        while ((size_t) (abp - bp) < MINBLOCKSIZE)
+            abp += align;
+        size_t csize = GET_SIZE(HDRP(bp));
+        size_t fsize = abp - bp;
+
+        // abp takes the rest, its prev allocated bit is cleared if the
+        // front is really freed (not deferred)
+        PUT(HDRP(abp), PACK(csize - fsize, 0b11));
+        PUT(HDRP(bp), PACK(fsize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+        free_block(a, bp);
+    }
+
+    trim_block(a, abp, asize);
+    return abp;
+}
+
+#if defined(TCACHE) || !defined(NDEBUG)
+/*
+ * payload_size - Usable bytes of allocated block bp: the slot size for a
+ *                slab slot, the block minus its header otherwise
+ */
+static size_t payload_size(void *bp) {
+#ifdef SLABS
+    slab_t *s = slab_of(arena_of(bp), bp);
+    if (s != NULL)
+        return s->size;
+#endif
+    return GET_SIZE(HDRP(bp)) - WSIZE;
+}
+#endif
+/*
+ * free - Free a block
+ */
+void free (void *bp) {
+    CHECK_OP(bp);
+    if (bp == NULL)
+        return;
+    PROF_FREE(bp);
+    TRACE_OP(TRACE_FREE, bp, NULL, 0);
+
+#ifdef MMAP_HUGE
+    if (is_mmapped(bp)) {
+        mmap_free(bp);
+        return;
+    }
+#endif
+#ifdef GUARD_PAGES
+    if (is_guarded(bp)) {
+        guard_free(bp);
+        return;
+    }
+#endif
+#ifdef HARDENED
+    harden_check(bp);
+#endif
+
+    STAT_BLOCK(free_count, bp);
+
+#ifdef TCACHE
+    if (tcache_put(bp, payload_size(bp)))
+        return;
+#endif
+
+    // The block goes back to the arena it came from
+    arena_t *a = arena_of(bp);
+#ifdef REMOTE_FREE
+    if (a != thread_arena) {
+        remote_push(a, bp);
+        return;
+    }
+#endif
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    free_block(a, bp);
+    UNLOCK(a);
+}
+
+/*
+ * free_sized - Free block bp, which was allocated for size bytes
+ */
+void free_sized(void *bp, size_t size) {
+    CHECK_OP(bp);
+    if (bp == NULL)
+        return;
+    assert(size_fits(bp, size));
+
+#ifdef SLABS
+    // Maybe a slot
+    if (size <= SLAB_MAX) {
+        free(bp);
+        return;
+    }
+#endif
+#ifdef MMAP_HUGE
+    // Maybe mapped
+    if (size >= MMAP_THRESHOLD) {
+        free(bp);
+        return;
+    }
+#endif
+
+    // A heap block
+#ifdef GUARD_PAGES
+    if (is_guarded(bp)) {
+        free(bp);
+        return;
+    }
+#endif
+#ifdef HARDENED
+    harden_check(bp);
+#endif
+    STAT_BLOCK(free_count, bp);
+    PROF_FREE(bp);
+    TRACE_OP(TRACE_FREE, bp, NULL, 0);
+
+#ifdef TCACHE
+    // Binned by the header: the block can be larger than size
+    if (tcache_put(bp, GET_SIZE(HDRP(bp)) - WSIZE))
+        return;
+#endif
+
+    arena_t *a = arena_of(bp);
+#ifdef REMOTE_FREE
+    if (a != thread_arena) {
+        remote_push(a, bp);
+        return;
+    }
+#endif
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    free_heap_block(a, bp);
+    UNLOCK(a);
+}
+
+#ifndef NDEBUG
+/*
+ * size_fits - Whether size bytes fit in allocated block bp, for free_sized
+ */
+static int size_fits(void *bp, size_t size) {
+#ifdef MMAP_HUGE
+    if (is_mmapped(bp))
+        return size <= GET_8B((char*) bp - MMAP_HDR) - MMAP_HDR;
+#endif
+#ifdef GUARD_PAGES
+    if (is_guarded(bp))
+        return size <= guard_size(bp);
+#endif
+    return size <= payload_size(bp);
+}
+#endif
+
+/*
+ * aligned_alloc - Allocate size bytes aligned to alignment, a power of two
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+    void *bp;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT)
+        return malloc(size);
+
+    // Block sizes have to fit the 32-bit header
+    if (size == 0 || size >= ((size_t) 1 << 30) || alignment >= ((size_t) 1 << 30)) {
+        if (size != 0)
+            errno = ENOMEM;
+        return NULL;
+    }
+
+    arena_t *a = arena_get();
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    if (a->heap_listp == 0 && heap_init(a) < 0)
+        bp = NULL;
+    else
+        bp = malloc_aligned_block(a, alignment, adjust_size(size));
+    UNLOCK(a);
+    STAT_BLOCK(malloc_count, bp);
+    CHECK_OP(bp);
+    PROF_ALLOC(bp, size);
+    TRACE_OP(TRACE_MALLOC, NULL, bp, size);
+    return bp;
+}
+
+/*
+ * posix_memalign - aligned_alloc, alignment also has to be a multiple of
+ *                  sizeof(void*). Returns 0, EINVAL or ENOMEM
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *bp;
+
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if ((bp = aligned_alloc(alignment, size)) == NULL && size != 0)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * free_block - Give block bp back to the free list of arena a, lock of a held
+ */
+static void free_block(arena_t *a, void *bp) {
+#ifdef SLABS
+    slab_t *s = slab_of(a, bp);
+    if (s != NULL) {
+        slab_free(a, s, bp);
+        return;
+    }
+#endif
+    free_heap_block(a, bp);
+}
+
+/*
+ * free_heap_block - Free heap block bp (not a slot) of arena a, lock of a held
+ */
+static void free_heap_block(arena_t *a, void *bp) {
+#ifdef FASTBINS
+    // Defer: bp stays marked allocated until fast_consolidate
+    size_t size = GET_SIZE(HDRP(bp));
+    if (size < FAST_MAX) {
+        CLEAR_GROWN(bp);
+        SET_LINK(bp, a->fastbins[size / DSIZE]);
+        SET_KEY(bp, size);
+        a->fastbins[size / DSIZE] = bp;
+        a->fast_bytes += size;
+        if (a->fast_bytes > FAST_MAX_BYTES)
+            fast_consolidate(a);
+        return;
+    }
+#endif
+
+    free_now(a, bp);
+}
+
+/*
+ * free_now - Mark heap block bp free and coalesce it, lock of a held
+ */
+static void free_now(arena_t *a, void *bp) {
+    void* next_bp = (void*) NEXT_BLKP(bp);
+
+    // Update header and footer of bp
+    // 2nd bit unchanged, 1st bit to 0, footer copy header
+    PUT(HDRP(bp), ( GET_SIZE(HDRP(bp)) | GET_PREV_ALLOC(HDRP(bp)) ) );
+    PUT(FTRP(bp), GET(HDRP(bp)) );
+
+    // Initialise bp (free block) pointers
+    SET_PREVP(bp, (size_t) NULL);
+    SET_NEXTP(bp, (size_t) NULL);
+
+    // Update next block that previous block is free, it keeps its other bits
+    PUT(HDRP(next_bp), GET(HDRP(next_bp)) & ~0x2);
+
+    trim_top(a, coalesce(a, bp));
+#ifdef SCAVENGE
+    scavenge_tick(a);
+#endif
+}
+
+/*
+ * mm_malloc_batch - Allocate up to n blocks of size bytes into ptrs,
+ *                   returns the number allocated, less than n if memory ran out
+ */
+size_t mm_malloc_batch(size_t size, void **ptrs, size_t n) {
+    size_t got = 0;
+    size_t asize;
+
+    if (size == 0 || n == 0)
+        return 0;
+
+#ifdef MMAP_HUGE
+    // Mapped one by one anyway
+    if (size >= MMAP_THRESHOLD) {
+        for (; got < n && (ptrs[got] = mmap_alloc(size)) != NULL; got++) {
+            CHECK_OP(ptrs[got]);
+            PROF_ALLOC(ptrs[got], size);
+            TRACE_OP(TRACE_MALLOC, NULL, ptrs[got], size);
+        }
+        return got;
+    }
+#endif
+
+    arena_t *a = arena_get();
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    if (a->heap_listp == 0 && heap_init(a) < 0) {
+        UNLOCK(a);
+        return 0;
+    }
+#ifdef SLABS
+    if (size <= SLAB_MAX) {
+        // Slabs hand out slots in order already
+        asize = SLAB_SLOT(SLAB_CLASS(size));
+        for (; got < n && (ptrs[got] = alloc_block(a, asize)) != NULL; got++)
+            ;
+    } else
+#endif
+    {
+        asize = adjust_size(size);
+        while (got < n) {
+            size_t k = carve_run(a, asize, ptrs + got, n - got);
+            if (k == 0)
+                break;
+            got += k;
+        }
+    }
+    UNLOCK(a);
+
+#if defined(STATS) || defined(PROFILE) || defined(TRACE) || defined(HEAP_CHECK)
+    size_t i;
+    for (i = 0; i < got; i++) {
+        STAT_BLOCK(malloc_count, ptrs[i]);
+        CHECK_OP(ptrs[i]);
+        PROF_ALLOC(ptrs[i], size);
+        TRACE_OP(TRACE_MALLOC, NULL, ptrs[i], size);
+    }
+#endif
+    return got;
+}
+
+/*
+ * carve_run - Allocate up to n blocks of asize bytes from one free block of
+ *             arena a into ptrs, lock of a held. The run is placed as one
+ *             block, then cut into blocks. Returns the number allocated
+ */
+static size_t carve_run(arena_t *a, size_t asize, void **ptrs, size_t n) {
+    size_t k = MIN(n, MAX(BATCH_BYTES / asize, 1));
+    size_t i, rsize;
+    char *bp;
+
+    // A block for the whole run, or for as much of it as possible
+    if ((bp = find_fit(a, k*asize)) == NULL)
+        bp = find_fit(a, asize);
+#ifdef FASTBINS
+    // Merge the deferred frees before growing the heap
+    if (bp == NULL && a->fast_bytes > 0) {
+        fast_consolidate(a);
+        if ((bp = find_fit(a, k*asize)) == NULL)
+            bp = find_fit(a, asize);
+    }
+#endif
+    if (bp == NULL && (bp = extend_heap(a, grow_size(a, k*asize)/WSIZE)) == NULL)
+        return 0;
+
+    k = MIN(k, GET_SIZE(HDRP(bp)) / asize);
+    bp = place(a, bp, k*asize);
+
+    // The last block keeps what place did not split off
+    rsize = GET_SIZE(HDRP(bp)) - (k - 1)*asize;
+    for (i = 0; i < k; i++) {
+        ptrs[i] = bp;
+        if (i > 0)
+            PUT(HDRP(bp), PACK(i < k - 1 ? asize : rsize, 0b11));
+        else
+            PUT(HDRP(bp), PACK(k > 1 ? asize : rsize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        bp += asize;
+    }
+    return k;
+}
+
+/*
+ * mm_free_batch - Free the n blocks of ptrs, NULL entries are skipped.
+ *                 ptrs is sorted in place by address; adjacent heap blocks
+ *                 of one arena are joined and freed as a single block
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    arena_t *a = NULL;
+    size_t i;
+
+    qsort(ptrs, n, sizeof(void*), cmp_addr);
+#ifdef TRACE
+    for (i = 0; i < n; i++) {
+        if (ptrs[i] != NULL)
+            TRACE_OP(TRACE_FREE, ptrs[i], NULL, 0);
+    }
+#endif
+
+#ifdef HARDENED
+    // Checked before any lock is taken, a pointer twice in ptrs is a double free
+    for (i = 0; i < n; i++) {
+        if (ptrs[i] == NULL)
+            continue;
+        if (i > 0 && ptrs[i] == ptrs[i - 1])
+            harden_abort("free(): double free", ptrs[i]);
+#ifdef MMAP_HUGE
+        if (is_mmapped(ptrs[i]))
+            continue;
+#endif
+#ifdef GUARD_PAGES
+        if (is_guarded(ptrs[i]))
+            continue;
+#endif
+        harden_check(ptrs[i]);
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        char *bp = ptrs[i];
+        if (bp == NULL)
+            continue;
+        PROF_FREE(bp);
+#ifdef MMAP_HUGE
+        if (is_mmapped(bp)) {
+            mmap_free(bp);
+            continue;
+        }
+#endif
+#ifdef GUARD_PAGES
+        if (is_guarded(bp)) {
+            guard_free(bp);
+            continue;
+        }
+#endif
+        STAT_BLOCK(free_count, bp);
+
+        // Blocks sorted by address come arena by arena, take each lock once
+        if (arena_of(bp) != a) {
+            if (a != NULL)
+                UNLOCK(a);
+            a = arena_of(bp);
+            LOCK(a);
+            REMOTE_DRAIN(a);
+        }
+#ifdef SLABS
+        slab_t *s = slab_of(a, bp);
+        if (s != NULL) {
+            slab_free(a, s, bp);
+            continue;
+        }
+#endif
+        // Join the blocks that follow bp directly (no slot starts where
+        // a heap block does, the slab_t is there)
+        while (i + 1 < n && ptrs[i + 1] == NEXT_BLKP(bp)) {
+            STAT_BLOCK(free_count, ptrs[i + 1]);
+            PROF_FREE(ptrs[i + 1]);
+            PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(ptrs[i + 1])),
+                GET_PREV_ALLOC(HDRP(bp)) | 1));
+            i++;
+        }
+        free_block(a, bp);
+    }
+    if (a != NULL)
+        UNLOCK(a);
+}
+
+static int cmp_addr(const void *x, const void *y) {
+    char *p = *(char* const*) x;
+    char *q = *(char* const*) y;
+    return (p > q) - (p < q);
+}
+
+#ifdef REMOTE_FREE
+/*
+ * remote_push - Queue block bp, freed by a thread that does not own arena
+ *               a, without its lock. It stays marked allocated until a
+ *               drain. Past REMOTE_MAX queued blocks the pusher drains
+ *               them, if it can take the lock right away
+ */
+static void remote_push(arena_t *a, void *bp) {
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    SET_KEY(bp, payload_size(bp));
+    do {
+        SET_LINK(bp, head);
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, bp, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    STAT_ADD(remote_frees, 1);
+
+    if (__atomic_add_fetch(&a->remote_count, 1, __ATOMIC_RELAXED) >= REMOTE_MAX &&
+        pthread_mutex_trylock(&a->lock) == 0) {
+        remote_drain(a);
+        UNLOCK(a);
+    }
+}
+
+/*
+ * remote_drain - Free the blocks on the remote queue of arena a, lock of a
+ *                held. The queue is taken whole; each batch is sorted by
+ *                address and runs of adjacent heap blocks are joined and
+ *                freed as one block, as mm_free_batch does
+ */
+static void remote_drain(arena_t *a) {
+    void *bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    void *run[REMOTE_BATCH];
+    unsigned long taken = 0;
+    size_t i, n;
+
+    STAT_ADD(remote_drains, 1);
+    while (bp != NULL) {
+        for (n = 0; n < REMOTE_BATCH && bp != NULL; n++) {
+            run[n] = bp;
+            bp = GET_LINK(bp);
+            CLEAR_KEY(run[n], payload_size(run[n]));
+        }
+        taken += n;
+        sort_addr(run, n);
+
+        for (i = 0; i < n; i++) {
+            char *p = run[i];
+#ifdef SLABS
+            slab_t *s = slab_of(a, p);
+            if (s != NULL) {
+                slab_free(a, s, p);
+                continue;
+            }
+#endif
+            while (i + 1 < n && run[i + 1] == NEXT_BLKP(p)) {
+                PUT(HDRP(p), PACK(GET_SIZE(HDRP(p)) + GET_SIZE(HDRP(run[i + 1])),
+                    GET_PREV_ALLOC(HDRP(p)) | 1));
+                i++;
+            }
+            free_heap_block(a, p);
+        }
+    }
+    __atomic_sub_fetch(&a->remote_count, taken, __ATOMIC_RELAXED);
+}
+
+/*
+ * sort_addr - Sort the n pointers of p by address, an insertion sort.
+ *             remote_drain runs with the lock held, where qsort cannot be
+ *             used: it may call free, which would take the lock again
+ */
+static void sort_addr(void **p, size_t n) {
+    size_t i, j;
+    for (i = 1; i < n; i++) {
+        void *x = p[i];
+        for (j = i; j > 0 && (char*) p[j - 1] > (char*) x; j--)
+            p[j] = p[j - 1];
+        p[j] = x;
+    }
+}
+#endif /* REMOTE_FREE */
+
+#ifdef FASTBINS
+/*
+ * fast_consolidate - Free every deferred block of arena a for real,
+ *                    coalescing it with its free neighbours, lock of a held
+ */
+static void fast_consolidate(arena_t *a) {
+    int i;
+    void *bp;
+    for (i = 0; i < FAST_BINS; i++) {
+        while ((bp = a->fastbins[i]) != NULL) {
+            a->fastbins[i] = GET_LINK(bp);
+            free_now(a, bp);
+        }
+    }
+    a->fast_bytes = 0;
+}
+#endif
+
+#ifdef TCACHE
+/*
+ * tcache_get - Pop a cached block that fits asize (a block or slot size)
+ *              from the bin of its payload class, refilling an empty bin
+ *              from the heap first.
+ *              Returns NULL if asize is not cached or the bin has no fit
+ */
+static void* tcache_get(size_t asize) {
+    struct tcache *tc = &tcache;
+    size_t need = asize - WSIZE;
+    size_t size;
+    void *bp;
+    int i;
+
+    // Bins are keyed by payload, slots have no header
+#ifdef SLABS
+    if (asize <= SLAB_MAX)
+        need = asize;
+#endif
+    i = get_class(need);
+
+    if (i >= TCACHE_CLASSES)
+        return NULL;
+
+    if (tc->bins[i] == NULL) {
+        // Refill: carve a batch of blocks under one lock acquisition
+        unsigned int n;
+        arena_t *a = arena_get();
+        tcache_register();
+        LOCK(a);
+        REMOTE_DRAIN(a);
+        for (n = 0; n < TCACHE_BATCH && tc->bytes + asize <= TCACHE_MAX_BYTES; n++) {
+            if ((bp = alloc_block(a, asize)) == NULL)
+                break;
+            SET_LINK(bp, tc->bins[i]);
+            SET_KEY(bp, payload_size(bp));
+            tc->bins[i] = bp;
+            tc->counts[i]++;
+            tc->bytes += payload_size(bp);
+        }
+        UNLOCK(a);
+    }
+
+    // Blocks of one class differ in size, the head has to fit
+    bp = tc->bins[i];
+    if (bp == NULL || (size = payload_size(bp)) < need)
+        return NULL;
+
+    tc->bins[i] = GET_LINK(bp);
+    tc->counts[i]--;
+    tc->bytes -= size;
+    CLEAR_KEY(bp, size);
+    return bp;
+}
+
+/*
+ * tcache_put - Push allocated block bp, of size payload bytes, into the
+ *              bin of its class. Returns 0 if its size is not cached.
+ *              A bin over TCACHE_COUNT, or a cache over TCACHE_MAX_BYTES,
+ *              is flushed back to the heap a batch at a time
+ */
+static int tcache_put(void *bp, size_t size) {
+    struct tcache *tc = &tcache;
+    int i = get_class(size);
+
+    if (i >= TCACHE_CLASSES)
+        return 0;
+
+#ifdef REALLOC_SLACK
+    // Handed out again as it is, a slot has no header
+#ifdef SLABS
+    if (slab_of(arena_of(bp), bp) == NULL)
+#endif
+        CLEAR_GROWN(bp);
+#endif
+    tcache_register();
+    SET_LINK(bp, tc->bins[i]);
+    SET_KEY(bp, size);
+    tc->bins[i] = bp;
+    tc->counts[i]++;
+    tc->bytes += size;
+
+    if (tc->counts[i] > TCACHE_COUNT || tc->bytes > TCACHE_MAX_BYTES) {
+        tcache_flush(tc, i, TCACHE_BATCH);
+        // Still over budget: other bins have to give back too
+        for (i = TCACHE_CLASSES - 1; i >= 0 && tc->bytes > TCACHE_MAX_BYTES; i--)
+            tcache_flush(tc, i, tc->counts[i]);
+    }
+    return 1;
+}
+
+/*
+ * tcache_flush - Free up to n blocks of bin i back to their arenas,
+ *                an arena lock is held across a run of blocks it owns
+ */
+static void tcache_flush(struct tcache *tc, int i, unsigned int n) {
+    arena_t *a, *locked = NULL;
+    void *bp;
+    while (n-- > 0 && (bp = tc->bins[i]) != NULL) {
+        tc->bins[i] = GET_LINK(bp);
+        tc->counts[i]--;
+        tc->bytes -= payload_size(bp);
+
+        a = arena_of(bp);
+#ifdef REMOTE_FREE
+        if (a != thread_arena) {
+            remote_push(a, bp);
+            continue;
+        }
+#endif
+        if (a != locked) {
+            if (locked != NULL)
+                UNLOCK(locked);
+            LOCK(a);
+            REMOTE_DRAIN(a);
+            locked = a;
+        }
+        free_block(a, bp);
+    }
+    if (locked != NULL)
+        UNLOCK(locked);
+}
+
+/*
+ * tcache_register - Install the exit destructor of this thread's cache,
+ *                   on its first use
+ */
+static void tcache_register(void) {
+    if (tcache.registered)
+        return;
+    // Set first: pthread_setspecific may allocate and come back here
+    tcache.registered = 1;
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_key, &tcache);
+}
+
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * tcache_destroy - Thread exit: give every cached block back to the heap
+ */
+static void tcache_destroy(void *arg) {
+    struct tcache *tc = arg;
+    int i;
+    for (i = 0; i < TCACHE_CLASSES; i++)
+        tcache_flush(tc, i, tc->counts[i]);
+}
+#endif /* TCACHE */
+
+#ifdef MMAP_HUGE
+/*
+ * is_mmapped - Whether bp was mapped by mmap_alloc. It sits at offset
+ *              MMAP_HDR in a 4 KiB page, where no slab slot starts, and has
+ *              size 0 in its header, which no heap block payload has
+ */
+static int is_mmapped(void *bp) {
+    return ((size_t) bp & (4096 - 1)) == MMAP_HDR && GET(HDRP(bp)) == PACK(0, 1);
+}
+
+/*
+ * mmap_alloc - Map a block of its own for a payload of size bytes
+ */
+static void* mmap_alloc(size_t size) {
+    size_t page = mem_pagesize();
+    size_t len;
+    char *p;
+
+    if (size > (size_t) -1 - MMAP_HDR - page)
+        return NULL;
+    len = (size + MMAP_HDR + page - 1) & ~(page - 1);
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+#ifdef HUGE_PAGES
+    if (len >= HUGE_PAGE)
+        madvise(p, len, MADV_HUGEPAGE);
+#endif
+
+    PUT_8B(p, len);
+    PUT(p + MMAP_HDR - WSIZE, PACK(0, 1));
+    STAT_ADD(mmap_count, 1);
+    STAT_HEAP(len);
+    return p + MMAP_HDR;
+}
+
+/*
+ * mmap_resize - Resize mapped block bp to a payload of size bytes with
+ *               mremap, moving it if needed. NULL if it cannot
+ */
+static void* mmap_resize(void *bp, size_t size) {
+#ifdef MREMAP_MAYMOVE
+    size_t page = mem_pagesize();
+    char *p = (char*) bp - MMAP_HDR;
+    size_t len;
+
+    if (size > (size_t) -1 - MMAP_HDR - page)
+        return NULL;
+    len = (size + MMAP_HDR + page - 1) & ~(page - 1);
+    if (len == GET_8B(p))
+        return bp;
+
+    p = mremap(p, GET_8B(p), len, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+        return NULL;
+    STAT_HEAP(len - GET_8B(p));
+    PUT_8B(p, len);
+    return p + MMAP_HDR;
+#else
+    (void) bp;
+    (void) size;
+    return NULL;
+#endif
+}
+
+/*
+ * mmap_free - Unmap mapped block bp
+ */
+static void mmap_free(void *bp) {
+    char *p = (char*) bp - MMAP_HDR;
+    STAT_ADD(munmap_count, 1);
+    STAT_HEAP(-(long) GET_8B(p));
+    munmap(p, GET_8B(p));
+}
+#endif /* MMAP_HUGE */
+
+#ifdef HARDENED
+/*
+ * harden_init - Draw the link secret, once. It never changes after, as
+ *               links in every arena are masked with it
+ */
+static void harden_init(void) {
+    size_t secret = 0, expected = 0;
+    unsigned char *r;
+
+    if (__atomic_load_n(&link_secret, __ATOMIC_ACQUIRE) != 0)
+        return;
+    // 16 random bytes from the kernel, the first 8 are the stack canary
+    if ((r = (unsigned char*) getauxval(AT_RANDOM)) != NULL)
+        memcpy(&secret, r + 8, sizeof(secret));
+    secret ^= ((size_t) &secret >> 4) * 0x9e3779b97f4a7c15ULL;
+    __atomic_compare_exchange_n(&link_secret, &expected, secret | 1, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * link_reveal - Link of block bp on a singly linked list, which has to be
+ *               aligned: a corrupted masked link hardly is
+ */
+static inline void* link_reveal(void *bp) {
+    size_t q = REVEAL(bp, GET_8B(bp));
+    if (q & (ALIGNMENT - 1))
+        harden_abort("corrupted free list link", bp);
+    return (void*) q;
+}
+
+/*
+ * harden_check - Abort unless bp, passed to free or realloc, is an
+ *                allocated heap block or slot
+ */
+static void harden_check(void *bp) {
+    arena_t *a = arena_of(bp);
+
+    if (!aligned(bp) || !in_heap(a, bp))
+        harden_abort("free(): invalid pointer", bp);
+#ifdef SLABS
+    slab_t *s = slab_of(a, bp);
+    if (s != NULL) {
+        if ((char*) bp < (char*) s + SLAB_HDR ||
+            ((char*) bp - (char*) s - SLAB_HDR) % s->size != 0)
+            harden_abort("free(): invalid pointer", bp);
+        if (s->size > DSIZE && FREE_KEY(bp) == FREE_KEY_VALUE && harden_cached(a, bp))
+            harden_abort("free(): double free", bp);
+        return;
+    }
+#endif
+    if (!GET_ALLOC(HDRP(bp)))
+        harden_abort("free(): double free", bp);
+    if (GET_SIZE(HDRP(bp)) < MINBLOCKSIZE || !GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))))
+        harden_abort("free(): invalid size or next header", bp);
+    if (FREE_KEY(bp) == FREE_KEY_VALUE && harden_cached(a, bp))
+        harden_abort("free(): double free", bp);
+}
+
+/*
+ * harden_cached - Whether allocated block bp of arena a, which has the
+ *                 double free key, is in this thread's tcache, in a fast
+ *                 bin, on the remote queue of a or among the free slots of
+ *                 its slab. Blocks in the tcache of another thread are not
+ *                 found
+ */
+static int harden_cached(arena_t *a, void *bp) {
+    void *p;
+    int found = 0;
+
+#ifdef TCACHE
+    int i = get_class(payload_size(bp));
+    if (i < TCACHE_CLASSES) {
+        for (p = tcache.bins[i]; p != NULL; p = GET_LINK(p))
+            if (p == bp)
+                return 1;
+    }
+#endif
+    LOCK(a);
+#ifdef REMOTE_FREE
+    // Drains take the lock, so nodes only come in at the head meanwhile
+    for (p = __atomic_load_n(&a->remote, __ATOMIC_ACQUIRE); p != NULL && !found; p = GET_LINK(p))
+        found = (p == bp);
+#endif
+#ifdef SLABS
+    slab_t *s = slab_of(a, bp);
+    if (s != NULL && !found) {
+        for (p = s->free; p != NULL && !found; p = GET_LINK(p))
+            found = (p == bp);
+    } else
+#endif
+    {
+#ifdef FASTBINS
+        size_t size = GET_SIZE(HDRP(bp));
+        if (size < FAST_MAX) {
+            for (p = a->fastbins[size / DSIZE]; p != NULL && !found; p = GET_LINK(p))
+                found = (p == bp);
+        }
+#endif
+    }
+    UNLOCK(a);
+    (void) p;
+    return found;
+}
+
+/*
+ * harden_abort - Report a violation found at bp and abort, without stdio
+ *                as the heap is not to be trusted
+ */
+static void harden_abort(const char *msg, void *bp) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "mm: %s (%p)\n", msg, bp);
+    if (write(STDERR_FILENO, buf, n) < 0)
+        abort();
+    abort();
+}
+#endif /* HARDENED */
+
+#ifdef GUARD_PAGES
+/*
+ * is_guarded - Whether bp came from guard_alloc
+ */
+static int is_guarded(void *bp) {
+    return (char*) bp >= guard_base && (char*) bp < guard_end;
+}
+
+/*
+ * guard_alloc - Give size bytes a page of their own, ending where an
+ *               inaccessible page starts. The request size sits in the
+ *               first word of the page. NULL if there is no slot left,
+ *               the request is then served as usual
+ */
+static void* guard_alloc(size_t size) {
+    size_t page = mem_pagesize();
+    unsigned long x = guard_rand;
+    char *p;
+
+    // Next gap uniform in [0, 2 * GUARD_RATE), the first one starts here
+    int first = (x == 0);
+    if (first)
+        x = (unsigned long) &x ^ link_secret;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    guard_rand = x;
+    guard_left = x % (2 * GUARD_RATE);
+    if (first)
+        return NULL;
+
+    pthread_mutex_lock(&guard_lock);
+    if (guard_base == NULL) {
+        p = mmap(NULL, (size_t) GUARD_SLOTS * 2 * page, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p != MAP_FAILED) {
+            guard_end = p + (size_t) GUARD_SLOTS * 2 * page;
+            guard_base = p;
+        }
+    }
+    // A freed slot waits until every slot has been used once
+    if (guard_base == NULL)
+        p = NULL;
+    else if (guard_carved < GUARD_SLOTS)
+        p = guard_base + (size_t) guard_carved++ * 2 * page;
+    else if (guard_head != guard_tail)
+        p = guard_base + (size_t) guard_ring[guard_head++ % GUARD_SLOTS] * 2 * page;
+    else
+        p = NULL;
+    pthread_mutex_unlock(&guard_lock);
+
+    if (p == NULL || mprotect(p, page, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+    PUT_8B(p, size);
+    STAT_HEAP(page);
+    return p + page - ALIGN(size);
+}
+
+/*
+ * guard_free - Make the page of guarded block bp inaccessible, its memory
+ *              given back, and queue its slot for reuse
+ */
+static void guard_free(void *bp) {
+    size_t page = mem_pagesize();
+    char *p = (char*) ((size_t) bp & ~(page - 1));
+
+    // A second free faults on the size
+    if ((char*) bp != p + page - ALIGN(GET_8B(p)) || ((p - guard_base) / page) % 2 != 0)
+        harden_abort("free(): invalid pointer", bp);
+    madvise(p, page, MADV_DONTNEED);
+    mprotect(p, page, PROT_NONE);
+    STAT_HEAP(-(long) page);
+
+    pthread_mutex_lock(&guard_lock);
+    guard_ring[guard_tail++ % GUARD_SLOTS] = (unsigned int) ((p - guard_base) / (2 * page));
+    pthread_mutex_unlock(&guard_lock);
+}
+
+/*
+ * guard_size - Request size of guarded block bp
+ */
+static size_t guard_size(void *bp) {
+    return GET_8B((size_t) bp & ~(mem_pagesize() - 1));
+}
+#endif /* GUARD_PAGES */
+
+#ifdef SLABS
+/*
+ * slab_origin - Page aligned address slab_map page 0 stands for
+ */
+static char* slab_origin(arena_t *a) {
+    if (a->id == 0)
+        return (char*) ((size_t) mem_heap_lo() & ~(size_t) (SLAB_SIZE - 1));
+    return a->base;
+}
+
+/*
+ * slab_of - Slab of arena a that bp is a slot of, NULL for a heap block
+ *           No heap block payload starts in a slab page: the header of the
+ *           block after a slab sits in its last word
+ */
+static slab_t* slab_of(arena_t *a, void *bp) {
+    size_t page = (size_t) ((char*) bp - slab_origin(a)) >> SLAB_LOG2;
+    if (page >= (size_t) SLAB_MAP_WORDS * 64 || 
+        !((a->slab_map[page / 64] >> (page % 64)) & 1))
+        return NULL;
+    return (slab_t*) ((size_t) bp & ~(size_t) (SLAB_SIZE - 1));
+}
+
+/*
+ * slab_mark - Set (on) or clear the slab_map bit of the page of slab s
+ */
+static void slab_mark(arena_t *a, slab_t *s, int on) {
+    size_t page = (size_t) ((char*) s - slab_origin(a)) >> SLAB_LOG2;
+    if (on) {
+        a->slab_map[page / 64] |= 1UL << (page % 64);
+        if (page / 64 >= a->slab_words)
+            a->slab_words = page / 64 + 1;
+    } else {
+        a->slab_map[page / 64] &= ~(1UL << (page % 64));
+    }
+}
+
+/*
+ * slab_link - Push slab s to the front of the list of its slot size
+ */
+static void slab_link(arena_t *a, slab_t *s) {
+    slab_t **head = &a->slabs[SLAB_CLASS(s->size)];
+    s->prev = NULL;
+    s->next = *head;
+    if (*head != NULL)
+        (*head)->prev = s;
+    *head = s;
+}
+
+/*
+ * slab_unlink - Take slab s off the list of its slot size
+ */
+static void slab_unlink(arena_t *a, slab_t *s) {
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        a->slabs[SLAB_CLASS(s->size)] = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+/*
+ * slab_create - Cut a new slab of class c out of the heap of arena a.
+ *               Its block is SLAB_SIZE bytes with the payload page aligned,
+ *               so the slots end before the header of the next block
+ */
+static slab_t* slab_create(arena_t *a, int c) {
+    slab_t *s = malloc_aligned_block(a, SLAB_SIZE, SLAB_SIZE);
+    if (s == NULL)
+        return NULL;
+
+    s->free = NULL;
+    s->size = SLAB_SLOT(c);
+    s->nslots = (SLAB_SIZE - WSIZE - SLAB_HDR) / s->size;
+    s->used = 0;
+    s->carved = 0;
+    slab_mark(a, s, 1);
+    slab_link(a, s);
+    return s;
+}
+
+/*
+ * slab_alloc - Hand out a slot of class c, from the first slab of the class
+ *              that has one, or from a new slab. NULL if the heap is full
+ */
+static void* slab_alloc(arena_t *a, int c) {
+    slab_t *s = a->slabs[c];
+    void *bp;
+
+    if (s == NULL && (s = slab_create(a, c)) == NULL)
+        return NULL;
+
+    // Reuse a freed slot first, then carve
+    if (s->free != NULL) {
+        bp = s->free;
+        s->free = GET_LINK(bp);
+        CLEAR_KEY(bp, s->size);
+    } else {
+        bp = (char*) s + SLAB_HDR + (size_t) s->carved * s->size;
+        s->carved++;
+    }
+
+    // Full slabs leave the list until a slot comes back
+    if (++s->used == s->nslots)
+        slab_unlink(a, s);
+    return bp;
+}
+
+/*
+ * slab_free - Give slot bp back to its slab s. An empty slab is freed to
+ *             the heap, unless it is the only one left of its slot size
+ */
+static void slab_free(arena_t *a, slab_t *s, void *bp) {
+    if (s->used-- == s->nslots)
+        slab_link(a, s);
+    SET_LINK(bp, s->free);
+    SET_KEY(bp, s->size);
+    s->free = bp;
+
+    if (s->used == 0 && (s->prev != NULL || s->next != NULL)) {
+        slab_unlink(a, s);
+        slab_mark(a, s, 0);
+        free_block(a, s);
+    }
+}
+#endif /* SLABS */
+
+/* find_fit - As list is already in ascending order, just search list
+            The first fit will be the best fit
+            Only the class of asize has to be walked: every block in a
+            larger class fits, so the smallest block of the first non-empty
+            larger class (found with the two bitmap levels) is the best fit there
+            Under LIFO_LISTS the class of asize is only probed, and only
+            walked to the end when no larger class has a block
+*/
+static void* find_fit(arena_t *a, size_t asize)
+{
+    int i = get_class(asize);
+    int g = i >> SL_LOG2;
+    int sl = i & (SL_COUNT - 1);
+    void* bp = NULL;
+    int probes = FIT_PROBES;
+
+    STAT_ADD(fit_calls, 1);
+
+    // Walk the class of asize, if it is non-empty
+    if (a->sl_bitmap[g] & (1u << sl)) {
+#ifdef LARGE_TREE
+        if (i == NUM_CLASSES-1)
+            return tree_best_fit((void*) GET_8B(get_root(a, i)), asize);
+#endif
+        // Start from 1st block
+        bp = (void*) GET_8B(get_root(a, i));
+
+        while (bp != NULL && probes-- > 0) {
+            void *next = (void*) GET_NEXTP(bp);
+            PREFETCH(next);
+            STAT_ADD(fit_probes, 1);
+            if (NODE_SIZE(bp) >= asize)
+                return bp; // Found
+            
+            // Goes to next block
+            bp = next;
+        }
+    }
+
+    // First non-empty larger class in the same group
+    unsigned int sl_map = a->sl_bitmap[g] & ~((2u << sl) - 1);
+    if (sl_map == 0) {
+        // Otherwise first non-empty larger group
+        size_t fl_map = a->fl_bitmap & ~(((size_t) 2 << g) - 1);
+        if (fl_map != 0) {
+            g = __builtin_ctzl(fl_map);
+            sl_map = a->sl_bitmap[g];
+        }
+    }
+    if (sl_map != 0)
+        return class_first(a, (g << SL_LOG2) + __builtin_ctz(sl_map));
+
+    // Nothing larger: finish a walk that ran out of probes
+    for (; bp != NULL; bp = (void*) GET_NEXTP(bp)) {
+        PREFETCH(GET_NEXTP(bp));
+        STAT_ADD(fit_probes, 1);
+        if (NODE_SIZE(bp) >= asize)
+            return bp;
+    }
+    
+    return NULL; /* No fit */
+}
+
+/*
+ * place_at_end - Whether place cuts asize bytes from the end of free block
+ *                bp rather than its start: blocks of PLACE_LARGE bytes or
+ *                more under SPLIT_ENDS, and with REALLOC_SLACK any block
+ *                if bp is the room after a grown block, but not a block
+ *                grow_alloc places
+ */
+static inline int place_at_end(arena_t *a, void *bp, size_t asize) {
+#ifdef REALLOC_SLACK
+    int i;
+    if (a->grow_front)
+        return 0;
+    for (i = 0; i < GROW_TAILS; i++) {
+        if (a->grow_tails[i] == bp)
+            return 1;
+    }
+#else
+    (void) a; (void) bp;
+#endif
+#ifdef SPLIT_ENDS
+    return asize >= PLACE_LARGE;
+#else
+    (void) asize;
+    return 0;
+#endif
+}
+
+/*
+ * place - remove the block bp from free list,
+ *         and only split if sizeof(remaining part) >= sizeof(smallest block)
+ *         Update heaaders and footers respectively
+ *         Returns the allocated block, which is the end of bp if
+ *         place_at_end says so
+ */
+static void* place(arena_t *a, void* bp, size_t asize)
+{
+    dbg_printf("Start of place\n");
+    //mm_checkheap(__LINE__);
+    size_t csize = GET_SIZE(HDRP(bp)); // Original size of block
+    size_t zero = GET_ZERO(HDRP(bp));
+    remove_from_free_list(a, bp);
+    a->placed_zero = (zero != 0);
+    // Size of remaining block if split occurs
+    size_t rsize = csize - asize; 
+
+#if defined(SPLIT_ENDS) || defined(REALLOC_SLACK)
+    if (rsize >= MINBLOCKSIZE && place_at_end(a, bp, asize)) { // split, bp keeps the front
+        STAT_ADD(splits, 1);
+        PUT(HDRP(bp), PACK(rsize, GET_PREV_ALLOC(HDRP(bp)) | zero));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        insert_to_free_list(a, bp);
+
+        // The end is allocated, previous is free
+        bp = (void*) NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(asize, 0b01));
+
+        // Update next block that previous block is allocated
+        void* next_bp = (void*) NEXT_BLKP(bp);
+        PUT(HDRP(next_bp), ( GET(HDRP(next_bp)) | 0b10 ) );
+        if (!GET_ALLOC(HDRP(next_bp)))
+            PUT(FTRP(next_bp), GET(HDRP(next_bp)) );
+    } else
+#endif
+    if ( rsize >= MINBLOCKSIZE ) { // split
+        STAT_ADD(splits, 1);
+        // Update header: Change size and last bit
+        // Second bit is copied
+        PUT(HDRP(bp), PACK(asize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+
+        // Block is split, get pointer to next block
+        void* new_bp = (void*) NEXT_BLKP(bp);
+
+        // Update header and footer, previous is allocated, self is free
+        // The remainder is as zero as the whole block was
+        PUT(HDRP(new_bp), PACK(rsize, 0b10 | zero));
+        PUT(FTRP(new_bp), PACK(rsize, 0b10 | zero));
+
+        // Initialise pointers
+        SET_PREVP(new_bp, (size_t) NULL);
+        SET_NEXTP(new_bp, (size_t) NULL);
+#ifdef SCAVENGE
+        // The remainder was free as long as the whole block
+        if (!zero && rsize >= SCAVENGE_MIN)
+            SET_STAMP(new_bp, STAMP(bp));
+#endif
+
+        // Insert new block back into free list
+        insert_to_free_list(a, new_bp);
+    }
+    else { // don't split
+        STAT_ADD(unsplit_bytes[get_class(csize)], rsize);
+        // Update header: Change size and last bit
+        // Second bit is copied
+        PUT(HDRP(bp), PACK(csize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+
+        // Find next block
+        void* next_bp = (void*) NEXT_BLKP(bp);
+
+        // Update footer of next block that previous block is allocated
+        PUT(HDRP(next_bp), ( GET(HDRP(next_bp)) | 0b10 ) );
+
+        // If next block is free, update footer
+        if (!GET_ALLOC(HDRP(next_bp)))
+            PUT(FTRP(next_bp), GET(HDRP(next_bp)) );
+    }
+
+    // The allocated block may reach into memory given back by trim_top
+    if ((char*) NEXT_BLKP(bp) > a->dirty_end)
+        a->dirty_end = (char*) NEXT_BLKP(bp);
+    return bp;
+}
+
+/*
+ * adjust_size - Block size needed for a payload of size bytes:
+ *               header overhead, alignment and minimum block size
+ */
+static size_t adjust_size(size_t size) {
+    if (size + WSIZE <= MINBLOCKSIZE)
+        return MINBLOCKSIZE;
+    return ALIGN(size + WSIZE);
+}
+
+/*
+ * trim_block - Cut allocated block bp down to asize bytes.
+ *              The tail is only split off if sizeof(tail) >= sizeof(smallest block),
+ *              it is then freed through coalesce so it merges with a free next block
+ */
+static void trim_block(arena_t *a, void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t rsize = csize - asize;
+    void* next_bp;
+
+    // A block grown in place may reach into memory given back by trim_top
+    if ((char*) bp + MIN(asize, csize) > a->dirty_end)
+        a->dirty_end = (char*) bp + MIN(asize, csize);
+
+    if (rsize < MINBLOCKSIZE) { // don't split
+        // Update next block that previous block is allocated
+        next_bp = (void*) NEXT_BLKP(bp);
+        PUT(HDRP(next_bp), ( GET(HDRP(next_bp)) | 0b10 ) );
+
+        // If next block is free, update footer
+        if (!GET_ALLOC(HDRP(next_bp)))
+            PUT(FTRP(next_bp), GET(HDRP(next_bp)) );
+        return;
+    }
+
+    // Update header: Change size, second bit is copied
+    PUT(HDRP(bp), PACK(asize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+
+    // Tail becomes a free block, previous is allocated
+    next_bp = (void*) NEXT_BLKP(bp);
+    PUT(HDRP(next_bp), PACK(rsize, 0b10));
+    PUT(FTRP(next_bp), GET(HDRP(next_bp)) );
+    SET_PREVP(next_bp, (size_t) NULL);
+    SET_NEXTP(next_bp, (size_t) NULL);
+
+    // Update the block after the tail that previous block is free, it keeps its other bits
+    void* after_bp = (void*) NEXT_BLKP(next_bp);
+    PUT(HDRP(after_bp), GET(HDRP(after_bp)) & ~0x2);
+    if (!GET_ALLOC(HDRP(after_bp)))
+        PUT(FTRP(after_bp), GET(HDRP(after_bp)) );
+
+    coalesce(a, next_bp);
+}
+
+/*
+ * trim_top - Give the pages of free block bp back to the OS if it is the
+ *            last block of the heap and has TRIM_THRESHOLD unused bytes
+ *            past TRIM_PAD, lock of a held. The first TRIM_PAD bytes
+ *            (with the header and links) and the page of the footer stay
+ */
+static void trim_top(arena_t *a, void *bp) {
+#ifdef HUGE_PAGES
+    size_t page = HUGE_PAGE;    // A partial huge page would be split
+#else
+    size_t page = mem_pagesize();
+#endif
+    char *lo, *hi;
+
+    if (GET_SIZE(HDRP(bp)) < TRIM_THRESHOLD || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        return;
+
+    lo = (char*) (((size_t) bp + TRIM_PAD + page - 1) & ~(page - 1));
+    hi = (char*) ((size_t) FTRP(bp) & ~(page - 1));
+    // Pages past dirty_end were not touched since the last trim
+    if (hi > a->dirty_end)
+        hi = a->dirty_end;
+    if (hi < lo + TRIM_THRESHOLD)
+        return;
+
+    madvise(lo, hi - lo, MADV_DONTNEED);
+    a->dirty_end = lo;
+}
+
+#ifdef SCAVENGE
+/*
+ * scavenge_tick - Count a free in arena a, and scavenge when a new epoch
+ *                 starts, lock of a held
+ */
+static void scavenge_tick(arena_t *a) {
+    struct timespec ts;
+    long now;
+
+    if (++a->scav_ops < SCAVENGE_EVERY)
+        return;
+    a->scav_ops = 0;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (now - a->scav_time < SCAVENGE_PERIOD)
+        return;
+    a->scav_time = now;
+    a->scav_epoch++;
+    scavenge(a, SCAVENGE_BYTES, SCAVENGE_AGE);
+}
+
+/*
+ * scavenge - Give back the pages of the free blocks of arena a that were
+ *            free for age epochs or more, largest classes first, until
+ *            budget bytes are given back, lock of a held. Returns the
+ *            bytes given back
+ */
+static size_t scavenge(arena_t *a, size_t budget, unsigned int age) {
+    size_t done = 0;
+    int i;
+
+    for (i = NUM_CLASSES - 1; i >= get_class(SCAVENGE_MIN) && done < budget; i--) {
+        void *bp = (void*) GET_8B(get_root(a, i));
+#ifdef LARGE_TREE
+        if (i == NUM_CLASSES - 1) {
+            done += scavenge_tree(a, bp, budget - done, age);
+            continue;
+        }
+#endif
+        for (; bp != NULL && done < budget; bp = (void*) GET_NEXTP(bp))
+            done += scavenge_block(a, bp, age);
+    }
+    STAT_ADD(scavenge_calls, 1);
+    STAT_ADD(scavenge_bytes, done);
+    return done;
+}
+
+#ifdef LARGE_TREE
+/*
+ * scavenge_tree - scavenge for the treap rooted at t, largest blocks first
+ */
+static size_t scavenge_tree(arena_t *a, void *t, size_t budget, unsigned int age) {
+    size_t done;
+
+    if (t == NULL)
+        return 0;
+    done = scavenge_tree(a, TREE_RIGHT(t), budget, age);
+    if (done < budget)
+        done += scavenge_block(a, t, age);
+    if (done < budget)
+        done += scavenge_tree(a, TREE_LEFT(t), budget - done, age);
+    return done;
+}
+#endif
+
+/*
+ * scavenge_block - Give back the whole pages of free block bp of arena a,
+ *                  unless it is known zero or was free for less than age
+ *                  epochs, lock of a held. The rest of the block is cleared
+ *                  so that it is known zero. Returns the bytes given back
+ */
+static size_t scavenge_block(arena_t *a, void *bp, unsigned int age) {
+#ifdef HUGE_PAGES
+    size_t page = HUGE_PAGE;    // A partial huge page would be split
+#else
+    size_t page = mem_pagesize();
+#endif
+    char *body = (char*) bp + NODESIZE; // The stamp, then the payload
+    char *lo, *hi;
+
+    if (GET_ZERO(HDRP(bp)) || GET_SIZE(HDRP(bp)) < SCAVENGE_MIN ||
+        a->scav_epoch - STAMP(bp) < age)
+        return 0;
+
+    lo = (char*) (((size_t) body + WSIZE + page - 1) & ~(page - 1));
+    hi = (char*) ((size_t) FTRP(bp) & ~(page - 1));
+    if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) != 0)
+        return 0;
+
+    memset(body, 0, lo - body);
+    memset(hi, 0, FTRP(bp) - hi);
+    PUT(HDRP(bp), GET(HDRP(bp)) | 0x4);
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    return hi - lo;
+}
+#endif /* SCAVENGE */
+
+/*
+ * mm_scavenge - Give back the pages of every large free block of every
+ *               arena now, returns the bytes given back (0 without SCAVENGE)
+ */
+size_t mm_scavenge(void) {
+    size_t done = 0;
+#ifdef SCAVENGE
+    arena_t *a = &arenas[0];
+
+    LOCK(a);
+    if (a->heap_listp != 0)
+        done += scavenge(a, (size_t) -1, 0);
+    UNLOCK(a);
+#ifdef MULTI_ARENA
+    int i;
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 1; i <= MAX_ARENAS; i++) {
+        a = &arenas[i];
+        if (a->base == NULL)
+            continue;
+        LOCK(a);
+        if (a->heap_listp != 0)
+            done += scavenge(a, (size_t) -1, 0);
+        UNLOCK(a);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+#endif
+#endif
+    return done;
+}
+
+/*
+ * resize_block - Change allocated block bp of arena a to asize bytes in place,
+ *                lock of a held. A block that grows takes up to want bytes
+ *                (want >= asize) if there is room. Returns 0 if it has to move
+ */
+static int resize_block(arena_t *a, void *bp, size_t asize, size_t want) {
+    size_t oldsize = GET_SIZE(HDRP(bp));
+    size_t avail;
+
+    // Shrink (or same size): give back the tail
+    if (asize <= oldsize) {
+        trim_block(a, bp, asize);
+        return 1;
+    }
+
+    void* next_bp = (void*) NEXT_BLKP(bp);
+    avail = oldsize;
+    if (!GET_ALLOC(HDRP(next_bp)))
+        avail += GET_SIZE(HDRP(next_bp));
+
+    // Last block before the epilogue (possibly followed by a free block):
+    // extend the heap so that the next block covers the shortfall
+    if (avail < asize && 
+        (GET_SIZE(HDRP(next_bp)) == 0 || 
+        (!GET_ALLOC(HDRP(next_bp)) && GET_SIZE(HDRP(NEXT_BLKP(next_bp))) == 0))) {
+        size_t extendsize = MAX(want - avail, grow_step(a));
+        if (extend_heap(a, extendsize/WSIZE) != NULL) {
+            // New space is coalesced with a free next block, if any
+            next_bp = (void*) NEXT_BLKP(bp);
+            avail = oldsize + GET_SIZE(HDRP(next_bp));
+        }
+    }
+
+    // Grow into the free next block
+    if (avail >= asize && !GET_ALLOC(HDRP(next_bp))) {
+        remove_from_free_list(a, next_bp);
+        PUT(HDRP(bp), PACK(avail, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+        trim_block(a, bp, MIN(avail, want));
+        MARK_GROWN(a, bp);
+        return 1;
+    }
+
+    return 0;
+}
+
+#ifdef REALLOC_SLACK
+/*
+ * grow_alloc - malloc for realloc moving a block to grow it: a heap block
+ *              is marked grown, and cut from the front of a free block so
+ *              that the remainder follows it
+ */
+static void* grow_alloc(size_t size) {
+    void *bp;
+
+#ifdef SLABS
+    if (size <= SLAB_MAX)
+        return malloc(size);
+#endif
+#ifdef MMAP_HUGE
+    if (size >= MMAP_THRESHOLD)
+        return malloc(size);
+#endif
+    arena_t *a = arena_get();
+    LOCK(a);
+    REMOTE_DRAIN(a);
+    a->grow_front = 1;
+    bp = malloc_block(a, adjust_size(size));
+    a->grow_front = 0;
+    if (bp != NULL)
+        mark_grown(a, bp);
+    UNLOCK(a);
+    STAT_BLOCK(malloc_count, bp);
+    CHECK_OP(bp);
+    PROF_ALLOC(bp, size);
+    return bp;
+}
+
+/*
+ * mark_grown - Mark heap block bp grown, and remember the free block after
+ *              it (if any) as its room, lock of a held
+ */
+static void mark_grown(arena_t *a, void *bp) {
+    void *next_bp = NEXT_BLKP(bp);
+
+    PUT(HDRP(bp), GET(HDRP(bp)) | 0x4);
+    if (!GET_ALLOC(HDRP(next_bp)))
+        a->grow_tails[a->grow_tail_next++ % GROW_TAILS] = next_bp;
+}
+#endif
+
+/*
+ * realloc - heap_realloc, recorded as one operation when tracing
+ */
+void *realloc(void *oldptr, size_t size) {
+#ifdef TRACE
+    if (trace_on && !trace_busy) {
+        void *newptr;
+        // The malloc and free it may call are part of this operation
+        trace_busy = 1;
+        newptr = heap_realloc(oldptr, size);
+        trace_busy = 0;
+        trace_op(TRACE_REALLOC, oldptr, newptr, size);
+        return newptr;
+    }
+#endif
+    return heap_realloc(oldptr, size);
+}
+
+/*
+ * heap_realloc - Resize the block in place whenever possible:
+ *                Shrink: split off the tail and free it
+ *                Grow:   absorb a free next block, extending the heap first
+ *                        if the block sits right before the epilogue
+ *                Otherwise fall back to malloc, copy and free
+ */
+static void* heap_realloc(void *oldptr, size_t size) {
+    size_t oldsize, asize;
+    void *newptr;
+    int resized;
+#ifdef REALLOC_SLACK
+    size_t want = size;  /* Payload bytes to grow to, with the slack */
+#endif
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+        free(oldptr);
+        return 0;
+    }
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(oldptr == NULL) {
+        return malloc(size);
+    }
+    CHECK_OP(oldptr);
+
+#ifdef MMAP_HUGE
+    if (is_mmapped(oldptr)) {
+        // Stays mapped while large enough, copied to the heap otherwise
+        if (size >= MMAP_THRESHOLD && (newptr = mmap_resize(oldptr, size)) != NULL) {
+            PROF_MOVE(oldptr, newptr, size);
+            return newptr;
+        }
+        oldsize = GET_8B((char*) oldptr - MMAP_HDR) - MMAP_HDR;
+        goto move;
+    }
+#endif
+#ifdef GUARD_PAGES
+    if (is_guarded(oldptr)) {
+        oldsize = guard_size(oldptr);
+        goto move;
+    }
+#endif
+#ifdef HARDENED
+    harden_check(oldptr);
+#endif
+
+    arena_t *a = arena_of(oldptr);
+#ifdef SLABS
+    slab_t *s = slab_of(a, oldptr);
+    if (s != NULL) {
+        // A slot stays put while the new size fits in it
+        if (size <= s->size) {
+            PROF_MOVE(oldptr, oldptr, size);
+            return oldptr;
+        }
+        oldsize = s->size;
+    } else
+#endif
+    {
+        oldsize = GET_SIZE(HDRP(oldptr)) - WSIZE; // Block minus its header
+        asize = adjust_size(size);
+
+#ifdef MMAP_HUGE
+        // A block growing past the threshold moves to a mapping
+        if (size >= MMAP_THRESHOLD && size > oldsize)
+            goto move;
+#endif
+#ifdef REALLOC_SLACK
+        // It grew before, and is likely to grow again
+        if (size > oldsize && GET_GROWN(HDRP(oldptr)))
+            want = MAX(size, oldsize + MIN(oldsize >> SLACK_SHIFT, SLACK_MAX));
+        LOCK(a);
+        REMOTE_DRAIN(a);
+        resized = resize_block(a, oldptr, asize, adjust_size(want));
+        UNLOCK(a);
+#else
+        LOCK(a);
+        REMOTE_DRAIN(a);
+        resized = resize_block(a, oldptr, asize, asize);
+        UNLOCK(a);
+#endif
+        if (resized) {
+            PROF_MOVE(oldptr, oldptr, size);
+            return oldptr;
+        }
+    }
+
+#ifdef MMAP_HUGE
+move:
+#endif
+#ifdef REALLOC_SLACK
+    if (size > oldsize)
+        newptr = grow_alloc(want);
+    else
+#endif
+    newptr = malloc(size);
+
+    /* If realloc() fails the original block is left untouched  */
+    if(!newptr) {
+        return 0;
+    }
+
+    /* Copy the old data */
+    if(size < oldsize) oldsize = size;
+    memcpy(newptr, oldptr, oldsize);
+
+    /* Free the old block. */
+    free(oldptr);
+
+    return newptr;
+
+}
+
+/*
+ * calloc - Allocate the block and set it to zero.
+ * This function is not tested by mdriver, but it is
+ * needed to run the traces.
+ * Blocks from mmap are zero already, blocks from a known zero block only
+ * need their old links and footer cleared
+ */
+void *calloc (size_t nmemb, size_t size) {
+    size_t bytes, csize;
+    void *newptr;
+    int zero;
+
+    if (size != 0 && nmemb > (size_t) -1 / size)
+        return NULL;
+    bytes = nmemb * size;
+
+    newptr = heap_alloc(bytes, &zero);
+    CHECK_OP(newptr);
+    PROF_ALLOC(newptr, bytes);
+    TRACE_OP(TRACE_MALLOC, NULL, newptr, bytes);
+    if (newptr == NULL)
+        return NULL;
+#ifdef MMAP_HUGE
+    if (is_mmapped(newptr))
+        return newptr;
+#endif
+#ifdef GUARD_PAGES
+    if (is_guarded(newptr))
+        return newptr;
+#endif
+    if (!zero) {
+        zero_fill(newptr, bytes);
+        return newptr;
+    }
+
+    memset(newptr, 0, MIN(bytes, NODESIZE));
+    csize = GET_SIZE(HDRP(newptr));
+    if (bytes > csize - DSIZE)
+        memset((char*) newptr + csize - DSIZE, 0, bytes - (csize - DSIZE));
+
+    return newptr;
+}
+
+/*
+ * zero_fill - memset(p, 0, n), with non-temporal stores for large n so that
+ *             clearing does not flush the cache
+ */
+static void zero_fill(void *p, size_t n) {
+#ifdef __SSE2__
+    if (n >= ZERO_NT_MIN) {
+        char *c = p;
+        char *end = c + n;
+        char *v = (char*) (((size_t) c + 15) & ~(size_t) 15);
+        __m128i z = _mm_setzero_si128();
+
+        memset(c, 0, v - c);
+        for (; v + 64 <= end; v += 64) {
+            _mm_stream_si128((__m128i*) v, z);
+            _mm_stream_si128((__m128i*) (v + 16), z);
+            _mm_stream_si128((__m128i*) (v + 32), z);
+            _mm_stream_si128((__m128i*) (v + 48), z);
+        }
+        _mm_sfence();
+        memset(v, 0, end - v);
+        return;
+    }
+#endif
+    memset(p, 0, n);
+}
+
+/*
+ * mm_stats - Copy the allocator counters to *st
+ *            Without STATS there are none: *st is zeroed and -1 returned
+ */
+int mm_stats(mm_stats_t *st) {
+#ifdef STATS
+    // Other threads may be counting, each counter is read on its own
+    size_t i;
+    for (i = 0; i < sizeof(stats) / sizeof(unsigned long); i++)
+        ((unsigned long*) st)[i] = __atomic_load_n(&((unsigned long*) &stats)[i], __ATOMIC_RELAXED);
+    return 0;
+#else
+    memset(st, 0, sizeof(*st));
+    return -1;
+#endif
+}
+
+/*
+ * mm_stats_print - Print the counters to f, size classes that were never
+ *                  used are left out
+ */
+void mm_stats_print(FILE *f) {
+    mm_stats_t st;
+    int i;
+
+    if (mm_stats(&st) < 0) {
+        fprintf(f, "mm: built without STATS\n");
+        return;
+    }
+    fprintf(f, "mm: heap %lu bytes, peak %lu bytes\n", st.heap_size, st.heap_peak);
+    fprintf(f, "mm: extend_heap %lu calls, %lu bytes; mmap %lu, munmap %lu\n",
+        st.extend_calls, st.extend_bytes, st.mmap_count, st.munmap_count);
+    fprintf(f, "mm: scavenge %lu passes, %lu bytes\n", st.scavenge_calls, st.scavenge_bytes);
+    fprintf(f, "mm: remote frees %lu, drains %lu\n", st.remote_frees, st.remote_drains);
+    fprintf(f, "mm: find_fit %lu calls, %.2f probes per call\n", st.fit_calls,
+        st.fit_calls ? (double) st.fit_probes / st.fit_calls : 0.0);
+    fprintf(f, "mm: insert %lu calls, %.2f blocks walked per call\n", st.insert_calls,
+        st.insert_calls ? (double) st.insert_walk / st.insert_calls : 0.0);
+    fprintf(f, "mm: splits %lu; coalesce case 1 %lu, 2 %lu, 3 %lu, 4 %lu\n", st.splits,
+        st.coalesce[0], st.coalesce[1], st.coalesce[2], st.coalesce[3]);
+    fprintf(f, "mm: %10s %12s %12s %12s %12s\n", "class >=", "mallocs", "frees",
+        "rounded", "unsplit");
+    for (i = 0; i < NUM_CLASSES; i++) {
+        if (st.malloc_count[i] == 0 && st.free_count[i] == 0)
+            continue;
+        fprintf(f, "mm: %10zu %12lu %12lu %12lu %12lu\n", class_min_size(i),
+            st.malloc_count[i], st.free_count[i], st.round_bytes[i], st.unsplit_bytes[i]);
+    }
+}
+
+/*
+ * mm_analyze - Walk the heap of every arena into *an, taking the arena
+ *              locks in turn. Blocks held in a tcache or a fast bin show
+ *              up as allocated, mapped blocks are not in any heap
+ */
+int mm_analyze(mm_analysis_t *an) {
+    int i;
+
+    memset(an, 0, sizeof(*an));
+    an->classes = MIN(NUM_CLASSES, MM_STATS_CLASSES);
+    for (i = 0; i < an->classes; i++)
+        an->class_min[i] = class_min_size(i);
+
+    for (i = 0; i <= MAX_ARENAS; i++) {
+        if (i > 0 && arenas[i].base == NULL)
+            continue;
+        LOCK(&arenas[i]);
+        if (arenas[i].heap_listp != 0)
+            analyze_arena(an, &arenas[i]);
+        UNLOCK(&arenas[i]);
+    }
+    return 0;
+}
+
+/*
+ * analyze_arena - Add the blocks of arena a to *an, lock of a held
+ */
+static void analyze_arena(mm_analysis_t *an, arena_t *a) {
+    char *start = NEXT_BLKP(a->heap_listp); // First block after the prologue
+    char *end = (a->id == 0) ? (char*) mem_heap_hi() + 1 : a->brk;
+    size_t len = (end - start + MM_ANALYZE_SPANS - 1) / MM_ANALYZE_SPANS;
+    char *bp;
+
+    for (bp = start; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        size_t size = GET_SIZE(HDRP(bp));
+        int c = MIN(get_class(size), MM_STATS_CLASSES - 1);
+
+        an->heap_bytes += size;
+        an->arena[a->id].heap_bytes += size;
+        if (!GET_ALLOC(HDRP(bp))) {
+            an->free_count[c]++;
+            an->free_bytes[c] += size;
+            an->free_total += size;
+            an->largest_free = MAX(an->largest_free, size);
+            continue;
+        }
+        an->alloc_count[c]++;
+        an->alloc_bytes[c] += size;
+        an->arena[a->id].alloc_bytes += size;
+        analyze_span(an->arena[a->id].span_alloc, len, bp - start, bp - start + size);
+#ifdef SLABS
+        slab_t *s = slab_of(a, bp);
+        if (s != NULL) {
+            an->slab_bytes += size;
+            an->slot_bytes += (size_t) s->used * s->size;
+        }
+#endif
+    }
+}
+
+/*
+ * analyze_span - Add the bytes [lo, hi) of a heap to the spans of len bytes
+ *                they fall in
+ */
+static void analyze_span(unsigned long *span, size_t len, size_t lo, size_t hi) {
+    while (lo < hi) {
+        size_t i = MIN(lo / len, MM_ANALYZE_SPANS - 1);
+        size_t next = MIN((i + 1) * len, hi);
+        span[i] += next - lo;
+        lo = next;
+    }
+}
+
+/*
+ * mm_analysis_print - Print analysis an to f: totals and fragmentation,
+ *                     the classes that have blocks, and the arenas in use
+ */
+void mm_analysis_print(FILE *f, const mm_analysis_t *an) {
+    unsigned long alloc = an->heap_bytes - an->free_total;
+    mm_stats_t st;
+    int i, j;
+
+    fprintf(f, "mm: heap blocks %lu bytes, %lu allocated, %lu free, largest free %lu\n",
+        an->heap_bytes, alloc, an->free_total, an->largest_free);
+    fprintf(f, "mm: external fragmentation %.1f%% (free bytes outside the largest free block)\n",
+        an->free_total ? 100.0 * (an->free_total - an->largest_free) / an->free_total : 0.0);
+    if (an->slab_bytes != 0)
+        fprintf(f, "mm: slabs %lu bytes, %.1f%% handed out as slots\n", an->slab_bytes,
+            100.0 * an->slot_bytes / an->slab_bytes);
+    if (mm_stats(&st) == 0 && st.request_bytes != 0) {
+        unsigned long round = 0, unsplit = 0;
+        for (i = 0; i < MM_STATS_CLASSES; i++) {
+            round += st.round_bytes[i];
+            unsplit += st.unsplit_bytes[i];
+        }
+        fprintf(f, "mm: internal fragmentation of all mallocs: rounding %.1f%%, unsplit %.1f%% of %lu bytes asked for\n",
+            100.0 * round / st.request_bytes, 100.0 * unsplit / st.request_bytes, st.request_bytes);
+    }
+
+    fprintf(f, "mm: %10s %10s %12s %10s %12s\n", "class >=", "free", "free bytes",
+        "allocated", "alloc bytes");
+    for (i = 0; i < an->classes; i++) {
+        if (an->free_count[i] == 0 && an->alloc_count[i] == 0)
+            continue;
+        fprintf(f, "mm: %10lu %10lu %12lu %10lu %12lu\n", an->class_min[i],
+            an->free_count[i], an->free_bytes[i], an->alloc_count[i], an->alloc_bytes[i]);
+    }
+
+    // Occupancy of each span of an arena, in tenths
+    for (i = 0; i < MM_ANALYZE_ARENAS; i++) {
+        unsigned long heap = an->arena[i].heap_bytes;
+        unsigned long len = (heap + MM_ANALYZE_SPANS - 1) / MM_ANALYZE_SPANS;
+        if (heap == 0)
+            continue;
+        fprintf(f, "mm: arena %2d %12lu bytes %5.1f%% allocated, spans ", i, heap,
+            100.0 * an->arena[i].alloc_bytes / heap);
+        for (j = 0; j < MM_ANALYZE_SPANS; j++)
+            fputc(len ? "0123456789#"[MIN(an->arena[i].span_alloc[j] * 10 / len, 10)] : '-', f);
+        fputc('\n', f);
+    }
+}
+
+#ifdef STATS
+/*
+ * stat_heap - Add delta bytes to the heap size and update the peak
+ */
+static void stat_heap(long delta) {
+#ifdef THREAD_SAFE
+    unsigned long size = __atomic_add_fetch(&stats.heap_size, delta, __ATOMIC_RELAXED);
+    unsigned long peak = __atomic_load_n(&stats.heap_peak, __ATOMIC_RELAXED);
+    // A failed exchange reloads peak
+    while (size > peak && !__atomic_compare_exchange_n(&stats.heap_peak, &peak, size,
+        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+#else
+    stats.heap_size += delta;
+    if (stats.heap_size > stats.heap_peak)
+        stats.heap_peak = stats.heap_size;
+#endif
+}
+
+/*
+ * stat_class - Size class of allocated block bp, by its slot size for a
+ *              slab slot and its block size otherwise
+ */
+static int stat_class(void *bp) {
+#ifdef SLABS
+    slab_t *s = slab_of(arena_of(bp), bp);
+    if (s != NULL)
+        return get_class(s->size);
+#endif
+    return get_class(GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * stat_request - Count a malloc of size bytes served by a block or slot of
+ *                asize bytes: what rounding adds, past the header of a block
+ */
+static void stat_request(size_t size, size_t asize) {
+    size_t hdr = WSIZE;
+#ifdef SLABS
+    if (asize <= SLAB_MAX)
+        hdr = 0; // A slot
+#endif
+    STAT_ADD(request_bytes, size);
+    STAT_ADD(round_bytes[get_class(asize)], asize - hdr - size);
+}
+
+/*
+ * stats_dump - Print the counters to stderr at exit if MM_STATS is set
+ */
+__attribute__((destructor))
+static void stats_dump(void) {
+    if (getenv("MM_STATS") != NULL)
+        mm_stats_print(stderr);
+}
+#endif
+
+/*
+ * mm_prof_set_rate - Sample about every bytes allocated, 0 stops sampling.
+ *                    Threads pick the rate up at their next sample
+ */
+void mm_prof_set_rate(long bytes) {
+#ifdef PROFILE
+    __atomic_store_n(&prof_rate, bytes < 0 ? 0 : bytes, __ATOMIC_RELAXED);
+    prof_left = 0;
+#else
+    (void) bytes;
+#endif
+}
+
+/*
+ * mm_prof_dump - Write the live samples to path as a pprof heap profile.
+ *                Returns -1 if the file cannot be written, or without PROFILE
+ */
+int mm_prof_dump(const char *path) {
+#ifdef PROFILE
+    char buf[64 + PROF_DEPTH * 20];
+    unsigned long count = 0, bytes = 0;
+    prof_sample_t *p;
+    long rate;
+    int fd, i, j, n;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+
+    // Nothing here may allocate: the lock is held and sampling is off
+    prof_busy = 1;
+    pthread_mutex_lock(&prof_lock);
+    rate = prof_rate > 0 ? prof_rate : PROF_RATE;
+    for (i = 0; i < PROF_BUCKETS; i++) {
+        for (p = prof_table[i]; p != NULL; p = p->next) {
+            count++;
+            bytes += p->size;
+        }
+    }
+    n = snprintf(buf, sizeof(buf), "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%ld\n",
+        count, bytes, count, bytes, rate);
+    prof_write(fd, buf, n);
+
+    // One line per sample, pprof adds up equal stacks
+    for (i = 0; i < PROF_BUCKETS; i++) {
+        for (p = prof_table[i]; p != NULL; p = p->next) {
+            n = snprintf(buf, sizeof(buf), "1: %zu [1: %zu] @", p->size, p->size);
+            for (j = 0; j < p->depth; j++)
+                n += snprintf(buf + n, sizeof(buf) - n, " %p", p->stack[j]);
+            buf[n++] = '\n';
+            prof_write(fd, buf, n);
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+
+    // pprof maps the addresses to binaries with the memory map
+    prof_write(fd, "\nMAPPED_LIBRARIES:\n", 19);
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        while ((n = read(maps, buf, sizeof(buf))) > 0)
+            prof_write(fd, buf, n);
+        close(maps);
+    }
+    prof_busy = 0;
+    return close(fd);
+#else
+    (void) path;
+    return -1;
+#endif
+}
+
+#ifdef PROFILE
+/*
+ * prof_record - Bytes to the next sample ran out at block bp of size
+ *               bytes: record it, and draw the next gap
+ */
+static void prof_record(void *bp, size_t size) {
+    prof_sample_t *p;
+    int first = (prof_rand == 0);
+    size_t h;
+
+    if (prof_rate < 0) {
+        char *env = getenv("MM_PROF_RATE");
+        prof_rate = env != NULL ? atol(env) : PROF_RATE;
+    }
+    prof_left = prof_next();
+    // The first gap of a thread starts here; backtrace may allocate
+    if (first || bp == NULL || prof_busy || prof_rate == 0)
+        return;
+
+    prof_busy = 1;
+    pthread_mutex_lock(&prof_lock);
+    if (prof_free_samples == NULL) {
+        // Samples come from a mapping of their own, never from the heap
+        char *chunk = mmap(NULL, PROF_CHUNK, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        size_t k;
+        if (chunk != MAP_FAILED) {
+            for (k = 0; k + sizeof(prof_sample_t) <= PROF_CHUNK; k += sizeof(prof_sample_t)) {
+                p = (prof_sample_t*) (chunk + k);
+                p->next = prof_free_samples;
+                prof_free_samples = p;
+            }
+        }
+    }
+    if ((p = prof_free_samples) != NULL) {
+        prof_free_samples = p->next;
+        p->bp = bp;
+        p->size = size;
+        p->depth = backtrace(p->stack, PROF_DEPTH);
+        h = PROF_HASH(bp);
+        p->next = prof_table[h % PROF_BUCKETS];
+        prof_table[h % PROF_BUCKETS] = p;
+        prof_filter[h]++;
+    }
+    pthread_mutex_unlock(&prof_lock);
+    prof_busy = 0;
+}
+
+/*
+ * prof_move - Block old, which may be sampled, was freed (bp NULL) or
+ *             resized to size bytes at bp
+ */
+static void prof_move(void *old, void *bp, size_t size) {
+    prof_sample_t **pp, *p;
+    size_t h = PROF_HASH(old);
+
+    // Frees by the profiler itself are never of sampled blocks
+    if (prof_busy)
+        return;
+    pthread_mutex_lock(&prof_lock);
+    for (pp = &prof_table[h % PROF_BUCKETS]; (p = *pp) != NULL; pp = &p->next) {
+        if (p->bp != old)
+            continue;
+        *pp = p->next;
+        prof_filter[h]--;
+        if (bp == NULL) {
+            p->next = prof_free_samples;
+            prof_free_samples = p;
+        } else {
+            // Same stack, new place and size
+            p->bp = bp;
+            p->size = size;
+            h = PROF_HASH(bp);
+            p->next = prof_table[h % PROF_BUCKETS];
+            prof_table[h % PROF_BUCKETS] = p;
+            prof_filter[h]++;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * prof_next - Bytes to the next sample, exponentially distributed with
+ *             mean prof_rate: -ln(u) * rate for u uniform in (0, 1],
+ *             with log2 of u from its exponent and a quadratic in the mantissa
+ */
+static long prof_next(void) {
+    unsigned long x = prof_rand;
+    union { double d; unsigned long u; } v;
+    double log2u;
+
+    if (prof_rate <= 0)
+        return (long) (~0UL >> 1);
+    if (x == 0)
+        x = (unsigned long) &x ^ 0x2545f4914f6cdd1dUL; // Seed from the stack address
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    prof_rand = x;
+
+    // u = (q + 1) / 2^26, q 26 random bits
+    v.d = (double) ((x >> 38) + 1);
+    log2u = (double) ((int) ((v.u >> 52) & 0x7ff) - 1023) - 26;
+    v.u = (v.u & ((1UL << 52) - 1)) | (1023UL << 52);
+    log2u += (v.d - 1) * (1.3465 - 0.3465 * (v.d - 1));
+    return (long) (-log2u * 0.6931471805599453 * prof_rate) + 1;
+}
+
+/*
+ * prof_write - write all of buf to fd
+ */
+static void prof_write(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * prof_dump_at_exit - Write the profile to MM_PROF, if set
+ */
+__attribute__((destructor))
+static void prof_dump_at_exit(void) {
+    char *path = getenv("MM_PROF");
+    if (path != NULL)
+        mm_prof_dump(path);
+}
+#endif
+
+#ifdef TRACE
+/*
+ * trace_clock - Time stamp of a record: the cycle counter on x86,
+ *               nanoseconds elsewhere
+ */
+static inline unsigned long long trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * trace_op - Record an operation of this thread: malloc of size bytes
+ *            that returned bp, free of old, or realloc of old to size
+ *            bytes that returned bp
+ */
+static void trace_op(int type, void *old, void *bp, size_t size) {
+    unsigned long long now = trace_clock();
+    trace_buf_t *b = trace_cur;
+    unsigned char *p;
+
+    if (b == NULL || b->len > TRACE_BUF - TRACE_REC_MAX) {
+        if ((b = trace_swap(b, now)) == NULL)
+            return;
+    }
+    p = b->data + b->len;
+    *p++ = (unsigned char) type;
+    p = trace_varint(p, now > trace_last ? now - trace_last : 0);
+    if (now > trace_last)
+        trace_last = now;
+    if (type != TRACE_MALLOC)
+        p = trace_pointer(p, old);
+    if (type != TRACE_FREE) {
+        p = trace_varint(p, size);
+        p = trace_pointer(p, bp);
+    }
+    // The length goes last, so that a buffer written at exit has whole records
+    b->len = p - b->data;
+}
+
+/*
+ * trace_varint - Put v at p as an LEB128 varint, returns the end
+ */
+static unsigned char* trace_varint(unsigned char *p, unsigned long long v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char) v;
+    return p;
+}
+
+/*
+ * trace_pointer - Put bp at p as the zigzag varint of its distance from
+ *                 the last pointer of the buffer, in 8 byte units
+ */
+static unsigned char* trace_pointer(unsigned char *p, void *bp) {
+    long d = ((long) bp - (long) trace_ptr) >> 3;
+    trace_ptr = (size_t) bp;
+    return trace_varint(p, ((unsigned long) d << 1) ^ (unsigned long) (d >> 63));
+}
+
+/*
+ * trace_swap - Queue this thread's buffer b (NULL before its first record)
+ *              for the writer and start an empty one at time now.
+ *              Returns NULL, and the record is dropped, if there is none
+ */
+static trace_buf_t* trace_swap(trace_buf_t *b, unsigned long long now) {
+    trace_buf_t *nb;
+
+    // The pthread calls may allocate, which is not recorded
+    trace_busy = 1;
+    pthread_once(&trace_once, trace_start);
+    if (trace_tid == 0)
+        pthread_setspecific(trace_key, &trace_cur);
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_tid == 0)
+        trace_tid = ++trace_tids;
+    if (b != NULL)
+        trace_queue_buf(b);
+    if ((nb = trace_idle) != NULL) {
+        trace_idle = nb->next;
+    } else if (trace_bufs < TRACE_BUFS_MAX &&
+               (nb = mmap(NULL, sizeof(trace_buf_t), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+        trace_bufs++;
+        nb->all = trace_all;
+        trace_all = nb;
+    } else {
+        nb = NULL;
+        trace_dropped++;
+    }
+    if (nb != NULL) {
+        nb->state = TRACE_RECORDING;
+        nb->tid = trace_tid;
+        nb->len = 0;
+        nb->start = now;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_cur = nb;
+    trace_last = now;
+    trace_ptr = 0;
+    trace_busy = 0;
+    return nb;
+}
+
+/*
+ * trace_queue_buf - Hand buffer b to the writer, trace_lock held
+ */
+static void trace_queue_buf(trace_buf_t *b) {
+    if (b->len == 0) {
+        b->state = TRACE_IDLE;
+        b->next = trace_idle;
+        trace_idle = b;
+        return;
+    }
+    b->state = TRACE_QUEUED;
+    b->next = NULL;
+    *trace_queue_tail = b;
+    trace_queue_tail = &b->next;
+    pthread_cond_broadcast(&trace_cond);
+}
+
+/*
+ * trace_start - First buffer of the process: create the thread exit key
+ *               and the writer. Without a writer, buffers are written at exit
+ */
+static void trace_start(void) {
+    pthread_attr_t attr;
+    pthread_t t;
+
+    pthread_key_create(&trace_key, trace_thread_exit);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&t, &attr, trace_writer, NULL);
+    pthread_attr_destroy(&attr);
 }
 
 /*
- * Initialize - return -1 on error, 0 on success. Creates 10*(8 bytes) spaces
- *               to hold the addresses of the start of 10 class sizes
- *              Final two 8 byte blocks are split into 4 bytes: 
- *              |--Alignment padding--|---Prologue Header---|
- *              |---Prologue Footer---|---Epilogue Header---|
- *              Heap list starts right after prologue header
+ * trace_writer - Write queued buffers to the trace, oldest first
  */
-int mm_init(void) {
-    if ((heap_listp = mem_sbrk(12*DSIZE)) == (void*)-1)
-        return -1;
-    
-    // Create segregated free list
-    PUT_8B(heap_listp, (size_t) NULL);           //block size <= 32  
-    PUT_8B(heap_listp + (1*DSIZE), (size_t) NULL); //block size 33 - 64
-    PUT_8B(heap_listp + (2*DSIZE), (size_t) NULL); //block size 65 - 128
-    PUT_8B(heap_listp + (3*DSIZE), (size_t) NULL); //block size 129 - 256
-    PUT_8B(heap_listp + (4*DSIZE), (size_t) NULL); //block size 257 - 512
-    PUT_8B(heap_listp + (5*DSIZE), (size_t) NULL); //block size 513 - 1024
-    PUT_8B(heap_listp + (6*DSIZE), (size_t) NULL); //block size 1025 - 2048
-    PUT_8B(heap_listp + (7*DSIZE), (size_t) NULL); //block size 2049 - 4096
-    PUT_8B(heap_listp + (8*DSIZE), (size_t) NULL); //block size 4097 - 8192
-    PUT_8B(heap_listp + (9*DSIZE), (size_t) NULL); //block size > 8192
-    
-    // Alignement padding
-    PUT(heap_listp + (10*DSIZE), 0); 
-    // Prologue header
-    PUT(heap_listp + (10*DSIZE + WSIZE), PACK(DSIZE, 0b01)); 
-    // Prologue footer, heaplist starts here
-    PUT(heap_listp + (11*DSIZE), PACK(DSIZE, 0b01)); 
-    // Epilogue header
-    PUT(heap_listp + (11*DSIZE + WSIZE), PACK(0, 0b11)); 
+static void* trace_writer(void *arg) {
+    trace_buf_t *b;
+    (void) arg;
 
-    seg_free_listp = heap_listp;
-    heap_listp += (11 * DSIZE);
+    trace_busy = 1;
+    pthread_mutex_lock(&trace_lock);
+    for (;;) {
+        while (trace_queue == NULL)
+            pthread_cond_wait(&trace_cond, &trace_lock);
+        b = trace_queue;
+        if ((trace_queue = b->next) == NULL)
+            trace_queue_tail = &trace_queue;
+        b->state = TRACE_WRITING;
+        trace_writing = 1;
+        pthread_mutex_unlock(&trace_lock);
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
-        return -1;
+        trace_write(b);
 
-    return 0;
+        pthread_mutex_lock(&trace_lock);
+        trace_writing = 0;
+        b->state = TRACE_IDLE;
+        b->next = trace_idle;
+        trace_idle = b;
+        pthread_cond_broadcast(&trace_cond);
+    }
+    return NULL;
 }
 
 /*
- * malloc - Allocate a block with at least size bytes of payload
+ * trace_write - Append buffer b to the trace as one chunk
  */
-void *malloc (size_t size) {
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;      
+static void trace_write(trace_buf_t *b) {
+    unsigned char hdr[16];
+    struct iovec iov[2];
+    ssize_t n;
 
-    if (heap_listp == 0){
-        mm_init();
+    memcpy(hdr, &b->tid, 4);
+    memcpy(hdr + 4, &b->len, 4);
+    memcpy(hdr + 8, &b->start, 8);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = b->data;
+    iov[1].iov_len = b->len;
+    while (iov[1].iov_len > 0) {
+        if ((n = writev(trace_fd, iov, 2)) <= 0)
+            return;
+        // Short write: carry on with what is left
+        if ((size_t) n < iov[0].iov_len) {
+            iov[0].iov_base = (char*) iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+            continue;
+        }
+        n -= iov[0].iov_len;
+        iov[0].iov_len = 0;
+        iov[1].iov_base = (char*) iov[1].iov_base + n;
+        iov[1].iov_len -= n;
     }
-    /* Ignore spurious requests */
-    if (size == 0)
-        return NULL;
+}
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= 2*DSIZE)                                          
-        asize = MINBLOCKSIZE;                                        
-    else
-        asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE); 
+/*
+ * trace_thread_exit - A thread exits: queue its buffer, and record nothing
+ *                     more of it
+ */
+static void trace_thread_exit(void *arg) {
+    trace_buf_t **cur = arg;
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {  
-        place(bp, asize);                  
-        return bp;
-    }
+    trace_busy = 1;
+    if (*cur == NULL)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    trace_queue_buf(*cur);
+    pthread_mutex_unlock(&trace_lock);
+    *cur = NULL;
+}
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize, CHUNKSIZE);                 
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
-        return NULL;                                  
-    place(bp, asize);                                 
-    return bp;
+/*
+ * trace_child - A forked child does not record, the trace is its parent's
+ */
+static void trace_child(void) {
+    trace_on = 0;
 }
 
 /*
- * free - Free a block
+ * trace_open - Start recording to the file named by MM_TRACE, if set
  */
-void free (void *bp) {
-    if (bp == NULL)
-        return;
-    //size_t size = GET_SIZE(HDRP(bp));
-    void* next_bp = (void*) NEXT_BLKP(bp);
+__attribute__((constructor))
+static void trace_open(void) {
+    char *path = getenv("MM_TRACE");
 
-    // Update header and footer of bp
-    // 2nd bit unchanged, 1st bit to 0, footer copy header
-    PUT(HDRP(bp), ( GET_SIZE(HDRP(bp)) | GET_PREV_ALLOC(HDRP(bp)) ) );
-    PUT(FTRP(bp), GET(HDRP(bp)) );
+    if (path == NULL || *path == '\0')
+        return;
+    // O_APPEND: the writer and trace_close never interleave within a chunk
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd < 0)
+        return;
+    if (write(trace_fd, "MMTRACE1", 8) != 8) {
+        close(trace_fd);
+        trace_fd = -1;
+        return;
+    }
+    pthread_atfork(NULL, NULL, trace_child);
+    trace_on = 1;
+}
 
-    // Initialise bp (free block) pointers
-    SET_PREVP(bp, (size_t) NULL);
-    SET_NEXTP(bp, (size_t) NULL);
+/*
+ * trace_close - Exit: stop recording and write out what the writer has
+ *               not, the queued buffers and those threads still record to
+ */
+__attribute__((destructor))
+static void trace_close(void) {
+    trace_buf_t *b;
 
-    // Update next block that previous block is free
-    PUT(HDRP(next_bp), ( GET_SIZE(HDRP(next_bp)) | GET_ALLOC(HDRP(next_bp)) ) );
+    if (!trace_on)
+        return;
+    trace_on = 0;
+    pthread_mutex_lock(&trace_lock);
+    while (trace_writing)
+        pthread_cond_wait(&trace_cond, &trace_lock);
+    for (b = trace_queue; b != NULL; b = b->next) {
+        trace_write(b);
+        b->state = TRACE_IDLE;
+    }
+    trace_queue = NULL;
+    trace_queue_tail = &trace_queue;
+    for (b = trace_all; b != NULL; b = b->all) {
+        if (b->state == TRACE_RECORDING && b->len > 0)
+            trace_write(b);
+    }
+    close(trace_fd);
+    pthread_mutex_unlock(&trace_lock);
 
-    coalesce(bp);
+    if (trace_dropped > 0) {
+        char buf[80];
+        int n = snprintf(buf, sizeof(buf), "mm: trace dropped %lu records\n", trace_dropped);
+        if (write(STDERR_FILENO, buf, n) < 0)
+            return;
+    }
 }
+#endif
 
-/* find_fit - As list is already in ascending order, just search list
-            The first fit will be the best fit
-*/
-static void* find_fit(size_t asize)
-{
-    void* root = get_root(asize);
 
-    // As long as root does not hit the prologue header, 
-    //  it can search all the class sizes larger than asize class
-    while (root != (heap_listp - DSIZE)) {
-        // Start from 1st block
-        void* bp = (void*) GET_8B(root);
+/*
+ * Return whether the pointer is in the heap of arena a.
+ * May be useful for debugging.
+ */
+static int in_heap(arena_t *a, const void *p) {
+    if (a->id != 0)
+        return (char*) p >= a->base && (char*) p < a->brk;
+    return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
 
-        while (bp != NULL) {
-            if (GET_SIZE(HDRP(bp)) >= asize)
-                return bp; // Found
-            
-            // Goes to next block
-            bp = (void*) GET_NEXTP(bp);
-        }
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
 
-        // Goes to next class size
-        root += DSIZE;
+/*
+ * check_error - Count a violation found at bp, the first one is kept
+ */
+static void check_error(check_t *c, int code, const void *bp, const char *msg) {
+    if (c->count++ == 0 && c->err != NULL) {
+        c->err->code = code;
+        c->err->bp = bp;
+        c->err->arena = c->arena;
+        c->err->msg = msg;
     }
-    
-    return NULL; /* No fit */
 }
 
+#ifdef HEAP_CHECK
 /*
- * place - remove the block bp from free list,
- *         and only split if sizeof(remaining part) >= sizeof(smallest block)
- *         Update heaaders and footers respectively
+ * check_block - O(1) check of allocated block bp, as passed to free or
+ *               returned by malloc: mapping header, slot of a slab, or a
+ *               heap block whose next block has its prev allocated bit set
  */
-static void place(void* bp, size_t asize)
-{
-    dbg_printf("Start of place\n");
-    //mm_checkheap(__LINE__);
-    size_t csize = GET_SIZE(HDRP(bp)); // Original size of block
-    remove_from_free_list(bp);
-    // Size of remaining block if split occurs
-    size_t rsize = csize - asize; 
-
-    if ( rsize >= MINBLOCKSIZE ) { // split
-        // Update header: Change size and last bit
-        // Second bit is copied
-        PUT(HDRP(bp), PACK(asize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
-
-        // Block is split, get pointer to next block
-        void* new_bp = (void*) NEXT_BLKP(bp);
-
-        // Update header and footer, previous is allocated, self is free
-        PUT(HDRP(new_bp), PACK(rsize, 0b10));
-        PUT(FTRP(new_bp), PACK(rsize, 0b10));
-
-        // Initialise pointers
-        SET_PREVP(new_bp, (size_t) NULL);
-        SET_NEXTP(new_bp, (size_t) NULL);
-
-        // Insert new block back into free list
-        insert_to_free_list(new_bp);
+static void check_block(check_t *c, void *bp) {
+#ifdef MMAP_HUGE
+    if (is_mmapped(bp)) {
+        if (GET_8B((char*) bp - MMAP_HDR) < mem_pagesize())
+            check_error(c, MM_ERR_HEADER, bp, "mapped block has a bad length");
+        return;
     }
-    else { // don't split
-        // Update header: Change size and last bit
-        // Second bit is copied
-        PUT(HDRP(bp), PACK(csize, (GET_PREV_ALLOC(HDRP(bp)) | 1)) );
+#endif
+#ifdef GUARD_PAGES
+    if (is_guarded(bp))
+        return;
+#endif
+    arena_t *a = arena_of(bp);
+    c->arena = a->id;
 
-        // Find next block
-        void* next_bp = (void*) NEXT_BLKP(bp);
+    if (!in_heap(a, bp)) {
+        check_error(c, MM_ERR_BOUNDS, bp, "block is not in the heap");
+        return;
+    }
+#ifdef SLABS
+    slab_t *s = slab_of(a, bp);
+    if (s != NULL) {
+        if ((char*) bp < (char*) s + SLAB_HDR || 
+            ((char*) bp - (char*) s - SLAB_HDR) % s->size != 0)
+            check_error(c, MM_ERR_SLAB, bp, "pointer is not a slot of its slab");
+        return;
+    }
+#endif
+    if (!aligned(bp)) {
+        check_error(c, MM_ERR_ALIGN, bp, "block is not aligned");
+        return;
+    }
+    size_t size = GET_SIZE(HDRP(bp));
+    if (!GET_ALLOC(HDRP(bp)) || size < MINBLOCKSIZE || size % ALIGNMENT != 0 ||
+        !in_heap(a, HDRP(NEXT_BLKP(bp)))) {
+        check_error(c, MM_ERR_HEADER, bp, "header is not an allocated block");
+        return;
+    }
+    if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))))
+        check_error(c, MM_ERR_PREV_ALLOC, bp, "next block takes the block for free");
+}
 
-        // Update footer of next block that previous block is allocated
-        PUT(HDRP(next_bp), ( GET(HDRP(next_bp)) | 0b10 ) );
+/*
+ * check_op - Per operation check of a block bp going in or out of the
+ *            allocator, and every CHECK_EVERY operations of the thread a
+ *            verification of the whole heap at level HEAP_CHECK.
+ *            A violation is printed and aborts
+ */
+static void check_op(void *bp) {
+#if HEAP_CHECK >= MM_CHECK_WALK
+    static __thread unsigned long ops;
+#endif
+    mm_heap_error_t err = { 0 };
+    check_t c = { &err, 0, 0 };
 
-        // If next block is free, update footer
-        if (!GET_ALLOC(HDRP(next_bp)))
-            PUT(FTRP(next_bp), GET(HDRP(next_bp)) );
+    if (bp != NULL)
+        check_block(&c, bp);
+#if HEAP_CHECK >= MM_CHECK_WALK
+    if (c.count == 0 && ++ops % CHECK_EVERY == 0)
+        c.count = mm_verify(HEAP_CHECK, &err);
+#endif
+    if (c.count != 0) {
+        fprintf(stderr, "mm: heap check failed: %s, block %p of arena %d\n",
+            err.msg, err.bp, err.arena);
+        abort();
     }
 }
+#endif
 
+#ifdef LARGE_TREE
 /*
- * realloc - Change the size of the block by mallocing a new block,
- *      copying its data, and freeing the old block. 
+ * check_tree - Check the treap rooted at t: free blocks of the last class,
+ *              search tree order on (size, address), heap order on priority.
+ *              Returns the number of nodes, stops past max nodes
  */
-void *realloc(void *oldptr, size_t size) {
-    /* Copied from mm-naive.c */
-    size_t oldsize;
-    void *newptr;
+static size_t check_tree(check_t *c, arena_t *a, void* t, size_t min, size_t max) {
+    void* l = TREE_LEFT(t);
+    void* r = TREE_RIGHT(t);
+    size_t n = 1;
 
-    /* If size == 0 then this is just free, and we return NULL. */
-    if(size == 0) {
-        free(oldptr);
-        return 0;
+    if (!in_heap(a, t) || GET_ALLOC(HDRP(t))) {
+        check_error(c, MM_ERR_TREE, t, "treap node is not a free block in the heap");
+        return n;
     }
+    if (GET_SIZE(HDRP(t)) < min)
+        check_error(c, MM_ERR_CLASS, t, "block is in the wrong size class");
 
-    /* If oldptr is NULL, then this is just malloc. */
-    if(oldptr == NULL) {
-        return malloc(size);
+    if (l != NULL && n <= max) {
+        if (!tree_less(l, t) || tree_prio(l) > tree_prio(t))
+            check_error(c, MM_ERR_TREE, t, "treap node and left child are out of order");
+        n += check_tree(c, a, l, min, max - n);
     }
-
-    newptr = malloc(size);
-
-    /* If realloc() fails the original block is left untouched  */
-    if(!newptr) {
-        return 0;
+    if (r != NULL && n <= max) {
+        if (!tree_less(t, r) || tree_prio(r) > tree_prio(t))
+            check_error(c, MM_ERR_TREE, t, "treap node and right child are out of order");
+        n += check_tree(c, a, r, min, max - n);
     }
+    return n;
+}
+#endif
 
-    /* Copy the old data. */
-    oldsize = *SIZE_PTR(oldptr);
-    if(size < oldsize) oldsize = size;
-    memcpy(newptr, oldptr, oldsize);
+#ifdef SLABS
+/*
+ * check_slabs - Check the slab lists of arena a: slot size of the list,
+ *               page marked in slab_map, slot counts and free slots
+ */
+static void check_slabs(check_t *c, arena_t *a) {
+    int i;
+    slab_t *s;
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        for (s = a->slabs[i]; s != NULL; s = s->next) {
+            unsigned int nfree = 0;
+            void *bp;
 
-    /* Free the old block. */
-    free(oldptr);
+            if (slab_of(a, s) != s || !GET_ALLOC(HDRP(s))) {
+                check_error(c, MM_ERR_SLAB, s, "slab is not a marked allocated block");
+                break;
+            }
+            if (s->size != SLAB_SLOT(i))
+                check_error(c, MM_ERR_SLAB, s, "slab is in the list of another slot size");
+            if (s->used >= s->nslots || s->carved > s->nslots || s->used > s->carved)
+                check_error(c, MM_ERR_SLAB, s, "slab has bad counts");
+            if (s->next != NULL && s->next->prev != s)
+                check_error(c, MM_ERR_LINKS, s, "slab mismatch with next slab");
 
-    return newptr;
+            for (bp = s->free; bp != NULL && nfree <= s->nslots; bp = GET_LINK(bp)) {
+                if (slab_of(a, bp) != s || 
+                    ((char*) bp - (char*) s - SLAB_HDR) % s->size != 0) {
+                    check_error(c, MM_ERR_SLAB, bp, "free slot is not a slot of its slab");
+                    break;
+                }
+                nfree++;
+            }
+            if (nfree != (unsigned int) (s->carved - s->used))
+                check_error(c, MM_ERR_SLAB, s, "slab free slots do not match its counts");
+        }
+    }
+}
+#endif
 
+#ifdef FASTBINS
+/*
+ * check_fastbins - Check the deferred frees of arena a: allocated blocks
+ *                  of the size of their bin, adding up to fast_bytes
+ */
+static void check_fastbins(check_t *c, arena_t *a) {
+    size_t bytes = 0;
+    int i;
+    void *bp;
+    for (i = 0; i < FAST_BINS; i++) {
+        for (bp = a->fastbins[i]; bp != NULL; bp = GET_LINK(bp)) {
+            if (!in_heap(a, bp) || !GET_ALLOC(HDRP(bp))) {
+                check_error(c, MM_ERR_FASTBIN, bp, "deferred block is not an allocated block");
+                break;
+            }
+            if (GET_SIZE(HDRP(bp)) != (size_t) i * DSIZE)
+                check_error(c, MM_ERR_FASTBIN, bp, "deferred block is in the wrong fast bin");
+            bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+    if (bytes != a->fast_bytes)
+        check_error(c, MM_ERR_FASTBIN, NULL, "fast bins do not add up to fast_bytes");
 }
+#endif
 
 /*
- * calloc - Allocate the block and set it to zero.
- * This function is not tested by mdriver, but it is
- * needed to run the traces.
+ * mm_checkheap - Check the invariants in my data structures, in every arena
+ *                Prints the first violation with the line of the call
  */
-void *calloc (size_t nmemb, size_t size) {
-    /* Copied from mm-naive.c */
-    size_t bytes = nmemb * size;
-    void *newptr;
+void mm_checkheap(int lineno) {
+    mm_heap_error_t err;
+    int n = mm_verify(MM_CHECK_FULL, &err);
+    if (n != 0)
+        printf("checkheap(%d): %d errors, first: %s, block %p of arena %d\n",
+            lineno, n, err.msg, err.bp, err.arena);
+}
+
+/*
+ * mm_verify - Check the heap at level (MM_CHECK_*, or'ed with
+ *             MM_CHECK_PARALLEL to check the arenas in parallel threads).
+ *             Returns the number of violations, the first one goes to *err
+ *             if err is not NULL. Takes the arena locks in turn; blocks
+ *             held in a tcache show up as allocated
+ */
+int mm_verify(int level, mm_heap_error_t *err) {
+    check_t c = { err, 0, 0 };
+    int i;
 
-    newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+    if (err != NULL)
+        memset(err, 0, sizeof(*err));
+#ifdef THREAD_SAFE
+    if (level & MM_CHECK_PARALLEL)
+        return verify_parallel(level & ~MM_CHECK_PARALLEL, err);
+#endif
+    level &= ~MM_CHECK_PARALLEL;
 
-    return newptr;
+    for (i = 0; i <= MAX_ARENAS; i++) {
+        if (i > 0 && arenas[i].base == NULL)
+            continue;
+        LOCK(&arenas[i]);
+        if (arenas[i].heap_listp != 0)
+            verify_arena(&c, &arenas[i], level);
+        UNLOCK(&arenas[i]);
+    }
+    return c.count;
 }
 
+#ifdef THREAD_SAFE
+/* One arena checked by verify_thread */
+struct verify_job {
+    arena_t *a;
+    int level;
+    pthread_t thread;
+    int started;
+    check_t c;
+    mm_heap_error_t err;
+};
 
 /*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
+ * verify_thread - Check the arena of job arg
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static void* verify_thread(void *arg) {
+    struct verify_job *j = arg;
+    LOCK(j->a);
+    if (j->a->heap_listp != 0)
+        verify_arena(&j->c, j->a, j->level);
+    UNLOCK(j->a);
+    return NULL;
 }
 
 /*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
+ * verify_parallel - mm_verify with a thread per arena in use. An arena
+ *                   whose thread cannot be created is checked in place
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+static int verify_parallel(int level, mm_heap_error_t *err) {
+    struct verify_job jobs[MAX_ARENAS + 1];
+    int i, count = 0;
+
+    for (i = 0; i <= MAX_ARENAS; i++) {
+        struct verify_job *j = &jobs[i];
+        memset(j, 0, sizeof(*j));
+        j->a = &arenas[i];
+        j->level = level;
+        j->c.err = &j->err;
+        if (i > 0 && arenas[i].base == NULL)
+            continue;
+        j->started = (pthread_create(&j->thread, NULL, verify_thread, j) == 0);
+        if (!j->started)
+            verify_thread(j);
+    }
+    for (i = 0; i <= MAX_ARENAS; i++) {
+        struct verify_job *j = &jobs[i];
+        if (j->started)
+            pthread_join(j->thread, NULL);
+        if (j->c.count != 0 && count == 0 && err != NULL)
+            *err = j->err;
+        count += j->c.count;
+    }
+    return count;
 }
+#endif
 
 /*
- * mm_checkheap - Check the invariants in my data structures
+ * verify_arena - Check arena a at level, lock of a held
+ *   MM_CHECK_HEADERS  prologue, epilogue and root table sentinels
+ *   MM_CHECK_WALK     every block of the heap: alignment, bounds,
+ *                     header/footer match, prev allocated bits, coalescing
+ *   MM_CHECK_FULL     also the free lists (class ranges, order, links,
+ *                     bitmaps), treap, slabs and fast bins, and that every
+ *                     free block of the walk is on the lists exactly once
  */
-void mm_checkheap(int lineno) {
+static void verify_arena(check_t *c, arena_t *a, int level) {
+    char *end = (a->id == 0) ? (char*) mem_heap_hi() + 1 : a->brk;
+    size_t nfree = 0, nlisted = 0;
+    int i;
     // Start of heap list
-    void *ptr = heap_listp;
-    dbg_printf("Entered checkheap\n");
+    void *ptr = NEXT_BLKP(a->heap_listp); // First block after the prologue
+
+    c->arena = a->id;
+    if (level < MM_CHECK_HEADERS)
+        return;
+
+    if (GET(HDRP(a->heap_listp)) != PACK(DSIZE, 1) || GET(a->heap_listp) != PACK(DSIZE, 1))
+        check_error(c, MM_ERR_HEADER, a->heap_listp, "prologue is damaged");
+    if (GET_SIZE(end - WSIZE) != 0 || !GET_ALLOC(end - WSIZE))
+        check_error(c, MM_ERR_HEADER, end, "epilogue is not at the end of the heap");
+    if (a->seg_free_listp + (NUM_CLASSES + 1)*DSIZE != a->heap_listp)
+        check_error(c, MM_ERR_HEADER, a->seg_free_listp, "root table is out of place");
+    if (level < MM_CHECK_WALK)
+        return;
 
     // Checking the heap
+    size_t prev_alloc = 1;
     while (GET_SIZE(HDRP(ptr)) > 0) {
-        
-        // Check alignment
-        if (!aligned(ptr))
-            printf("bp %p is not aligned\n", ptr);
-        // Check in heap
-        if (!in_heap(ptr))
-            printf("bp %p is not in heap\n", ptr);
-        
-        // Check coalescing
-        if (!GET_ALLOC(HDRP(ptr)) && !GET_PREV_ALLOC(HDRP(ptr)) )
-            printf ("bp %p and previous block are both free\n", ptr);
-        if (!GET_ALLOC(HDRP(ptr)) && !GET_ALLOC(HDRP(NEXT_BLKP(ptr))) )
-            printf ("bp %p and next block are both free\n", ptr);
-
-        // Check header and footer size match for free block
-        // Check for pointer consistency for free block
-        if (!GET_ALLOC(HDRP(ptr)) ) {
-            if (GET_SIZE(HDRP(ptr)) != GET_SIZE(FTRP(ptr)) )
-                printf ("size in free block %p's header and footer does not match\n", ptr);
-            
-            // If this is the first or last block in the list, continue
-            if (GET_NEXTP(ptr)== (size_t) NULL || GET_PREVP(ptr)==(size_t)NULL){
-                ptr = NEXT_BLKP(ptr);
-                continue;
-            }
-            // Check pointer consistency
-            if (ptr != (void*) GET_PREVP(GET_NEXTP(ptr)) )
-                printf("pointer %p mismatch with next block\n", ptr);
-            if (ptr != (void*) GET_NEXTP(GET_PREVP(ptr)) )
-                printf("pointer %p mismatch with previous block\n", ptr);
+        // A bad pointer or size ends the walk, the next block is unknown
+        if (!aligned(ptr)) {
+            check_error(c, MM_ERR_ALIGN, ptr, "block is not aligned");
+            return;
+        }
+        if (!in_heap(a, ptr) || (char*) NEXT_BLKP(ptr) > end) {
+            check_error(c, MM_ERR_BOUNDS, ptr, "block is not in the heap");
+            return;
+        }
 
+        if ((GET_PREV_ALLOC(HDRP(ptr)) != 0) != (prev_alloc != 0))
+            check_error(c, MM_ERR_PREV_ALLOC, ptr, "prev allocated bit does not match previous block");
+        prev_alloc = GET_ALLOC(HDRP(ptr));
+
+        if (!GET_ALLOC(HDRP(ptr))) {
+            nfree++;
+            // Check coalescing
+            if (!GET_PREV_ALLOC(HDRP(ptr)))
+                check_error(c, MM_ERR_COALESCE, ptr, "block and previous block are both free");
+            if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr))))
+                check_error(c, MM_ERR_COALESCE, ptr, "block and next block are both free");
+            // Check header and footer match for free block
+            if (GET(HDRP(ptr)) != GET(FTRP(ptr)))
+                check_error(c, MM_ERR_FOOTER, ptr, "free block header and footer do not match");
         }
 
         ptr = NEXT_BLKP(ptr);
-        
     }
-    dbg_printf("out of checkheap while loop\n");
+    if ((char*) ptr != end)
+        check_error(c, MM_ERR_BOUNDS, ptr, "heap ends before the epilogue");
+    if ((GET_PREV_ALLOC(HDRP(ptr)) != 0) != (prev_alloc != 0))
+        check_error(c, MM_ERR_PREV_ALLOC, ptr, "epilogue prev allocated bit does not match");
+    if (level < MM_CHECK_FULL)
+        return;
+
     // Check the segregated free list: correct class size and order
-    unsigned int min = 0, max = 0, i = 0;
-    for (i = 0; i < 10; i++) {
-
-        // All sizes in bytes
-        switch (i){
-            case 0:
-                min = 0;
-                max = 32; 
-                break;
-            case 1:
-                min = 33;
-                max = 64; 
-                break;
-            case 2:
-                min = 65;
-                max = 128; 
-                break;
-            case 3:
-                min = 129;
-                max = 256; 
-                break;
-            case 4:
-                min = 257;
-                max = 512; 
-                break;
-            case 5:
-                min = 513;
-                max = 1024; 
-                break;
-            case 6:
-                min = 1025;
-                max = 2048; 
-                break;
-            case 7:
-                min = 2049;
-                max = 4096; 
-                break;
-            case 8:
-                min = 4097;
-                max = 8192; 
-                break;
-            case 9: 
-                min = 8193;
-                max = (1<<31);
-                break;
-        }
- 
-        ptr = seg_free_listp + (i*DSIZE);
-        dbg_printf("i=%d\n", i);
+    for (i = 0; i < NUM_CLASSES; i++) {
+        // All sizes in bytes, same table as get_class
+        size_t min = class_min_size(i);
+        size_t max = (i == NUM_CLASSES-1) ? (size_t) -1 : class_min_size(i+1) - 1;
+        void *prev = NULL;
        
-        ptr = (void*) GET_8B(ptr);
+        ptr = (void*) GET_8B(get_root(a, i));
+
+        // Check the bitmap agrees with the list
+        if ((ptr != (void*) NULL) != 
+            ((a->sl_bitmap[i >> SL_LOG2] >> (i & (SL_COUNT - 1))) & 1))
+            check_error(c, MM_ERR_BITMAP, ptr, "bitmap bit of class does not match its free list");
+        if ((i & (SL_COUNT - 1)) == 0 &&
+            ((a->fl_bitmap >> (i >> SL_LOG2)) & 1) != (a->sl_bitmap[i >> SL_LOG2] != 0))
+            check_error(c, MM_ERR_BITMAP, NULL, "group bitmap bit does not match its classes");
+
         // If this size class list is empty, continue
         if (ptr == (void*) NULL) 
             continue;
+
+#ifdef LARGE_TREE
+        if (i == NUM_CLASSES-1) {
+            nlisted += check_tree(c, a, ptr, min, nfree + 1);
+            continue;
+        }
+#endif
         
-        dbg_printf("after continue\n"); 
-        
-        // Found non-null free list, then traverse it
+        // Traverse the list, a cycle shows up as more blocks than are free
         while (ptr != (void*) NULL) {
-            dbg_printf("inside while loop i=%d max=%d min =%d\n", i, max, min);
-            unsigned int fbsize = GET_SIZE(HDRP(ptr));
-            unsigned int nxsize = 0;
-            dbg_printf("fbsize=%d\n", fbsize);
+            if (!in_heap(a, ptr) || !aligned(ptr) || GET_ALLOC(HDRP(ptr))) {
+                check_error(c, MM_ERR_LINKS, ptr, "free list points to a block that is not free");
+                break;
+            }
+            if (++nlisted > nfree) {
+                check_error(c, MM_ERR_LIST_COUNT, ptr, "free lists hold more blocks than the heap");
+                return;
+            }
+            size_t fbsize = GET_SIZE(HDRP(ptr));
             if (fbsize > max || fbsize < min)
-                printf("Bp %p is in the wrong size class. \n", ptr);
+                check_error(c, MM_ERR_CLASS, ptr, "block is in the wrong size class");
+            if (NODE_SIZE(ptr) != fbsize)
+                check_error(c, MM_ERR_HEADER, ptr, "size in the block differs from its header");
+            if ((void*) GET_PREVP(ptr) != prev)
+                check_error(c, MM_ERR_LINKS, ptr, "block mismatch with previous block");
 
+#ifndef LIFO_LISTS
             // Check order
-            if (GET_NEXTP(ptr) != (size_t) NULL) {
-                nxsize = GET_SIZE(HDRP(GET_NEXTP(ptr)));
-                if (fbsize > nxsize)
-                    printf("Bp %p is in the wrong order.\n", ptr);
-            }
-            
+            if (GET_NEXTP(ptr) != (size_t) NULL && in_heap(a, (void*) GET_NEXTP(ptr)) &&
+                fbsize > GET_SIZE(HDRP(GET_NEXTP(ptr))))
+                check_error(c, MM_ERR_ORDER, ptr, "block is in the wrong order");
+#ifdef SPLIT_ENDS
+            if (GET_NEXTP(ptr) != (size_t) NULL && in_heap(a, (void*) GET_NEXTP(ptr)) &&
+                fbsize == GET_SIZE(HDRP(GET_NEXTP(ptr))) && GET_NEXTP(ptr) < (size_t) ptr)
+                check_error(c, MM_ERR_ORDER, ptr, "blocks of equal size are not in address order");
+#endif
+#endif
+            prev = ptr;
             ptr = (void*) GET_NEXTP(ptr);
-            dbg_printf("end of while loop 1\n");
         }
-        dbg_printf("end of while loop 2\n");
     }
+    // Listed blocks are distinct free blocks, so equal counts are a match
+    if (nlisted != nfree)
+        check_error(c, MM_ERR_LIST_COUNT, NULL, "free blocks of the heap are missing from the lists");
 
-    dbg_printf("End of checkheap\n");
+#ifdef SLABS
+    check_slabs(c, a);
+#endif
+#ifdef FASTBINS
+    check_fastbins(c, a);
+#endif
 }
-
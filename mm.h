@@ -7,6 +7,9 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void mm_free_sized (void *ptr, size_t size);
+extern void *mm_aligned_alloc (size_t alignment, size_t size);
+extern int mm_posix_memalign (void **memptr, size_t alignment, size_t size);
 
 #else
 
@@ -15,10 +18,121 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void free_sized (void *ptr, size_t size);
+extern void *aligned_alloc (size_t alignment, size_t size);
+extern int posix_memalign (void **memptr, size_t alignment, size_t size);
 
 #endif
 
 extern int mm_init(void);
 
+/* Allocate n blocks of size bytes into ptrs, returns how many it got */
+extern size_t mm_malloc_batch(size_t size, void **ptrs, size_t n);
+/* Free the n blocks of ptrs (NULL entries are skipped), sorts ptrs in place */
+extern void mm_free_batch(void **ptrs, size_t n);
+/* Give back the pages of all large free blocks now, returns the bytes */
+extern size_t mm_scavenge(void);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
+
+/* Heap verifier levels, see mm_verify */
+#define MM_CHECK_HEADERS  1      /* Sentinels of each arena, O(1) */
+#define MM_CHECK_WALK     2      /* Every block of the heap */
+#define MM_CHECK_FULL     3      /* Also free lists, slabs and fast bins */
+#define MM_CHECK_PARALLEL 0x100  /* Or'ed in: a thread per arena */
+
+/* Kinds of violation */
+enum {
+    MM_ERR_NONE = 0,
+    MM_ERR_ALIGN,       /* Misaligned block */
+    MM_ERR_BOUNDS,      /* Block outside its heap */
+    MM_ERR_HEADER,      /* Bad header, prologue or epilogue */
+    MM_ERR_FOOTER,      /* Free block footer differs from its header */
+    MM_ERR_PREV_ALLOC,  /* Prev allocated bit does not match */
+    MM_ERR_COALESCE,    /* Two free blocks next to each other */
+    MM_ERR_LINKS,       /* Broken free list links */
+    MM_ERR_CLASS,       /* Free block in the wrong size class */
+    MM_ERR_ORDER,       /* Sorted class out of order */
+    MM_ERR_BITMAP,      /* Class bitmaps disagree with the lists */
+    MM_ERR_TREE,        /* Treap out of order */
+    MM_ERR_LIST_COUNT,  /* Free blocks and listed blocks do not match */
+    MM_ERR_SLAB,        /* Bad slab or slot */
+    MM_ERR_FASTBIN      /* Bad deferred free */
+};
+
+/* First violation found by mm_verify */
+typedef struct {
+    int code;           /* MM_ERR_* */
+    const void *bp;     /* Block it was found at, or NULL */
+    int arena;          /* Arena of the block */
+    const char *msg;    /* What is wrong */
+} mm_heap_error_t;
+
+/* Check the heap at a level, returns the number of violations */
+extern int mm_verify(int level, mm_heap_error_t *err);
+
+/* Counters kept by mm.c when it is built with -DSTATS, see mm_stats */
+#define MM_STATS_CLASSES 256
+
+typedef struct {
+    unsigned long malloc_count[MM_STATS_CLASSES]; /* Per size class of the block */
+    unsigned long free_count[MM_STATS_CLASSES];
+    unsigned long mmap_count;      /* Blocks mapped on their own */
+    unsigned long munmap_count;
+    unsigned long fit_calls;       /* find_fit searches */
+    unsigned long fit_probes;      /* Free blocks looked at by find_fit */
+    unsigned long insert_calls;    /* Free list inserts */
+    unsigned long insert_walk;     /* Blocks passed to find the insert position */
+    unsigned long splits;          /* Free blocks split by place */
+    unsigned long coalesce[4];     /* coalesce cases 1 to 4 */
+    unsigned long extend_calls;    /* extend_heap calls */
+    unsigned long extend_bytes;
+    unsigned long scavenge_calls;  /* scavenge passes */
+    unsigned long scavenge_bytes;  /* Bytes they gave back */
+    unsigned long remote_frees;    /* Frees queued for the arena of another thread */
+    unsigned long remote_drains;   /* Remote queues drained */
+    unsigned long heap_size;       /* Bytes of heap and mappings now */
+    unsigned long heap_peak;       /* Largest heap_size so far */
+    unsigned long request_bytes;   /* Bytes asked for by malloc */
+    unsigned long round_bytes[MM_STATS_CLASSES];   /* Added to them by rounding, per class of the block */
+    unsigned long unsplit_bytes[MM_STATS_CLASSES]; /* Remainders place did not split off */
+} mm_stats_t;
+
+/* Copy the counters to *st, returns -1 (and zeros) without STATS */
+extern int mm_stats(mm_stats_t *st);
+/* Print the counters to f */
+extern void mm_stats_print(FILE *f);
+
+/* Heap walk of mm_analyze, per size class and per arena */
+#define MM_ANALYZE_ARENAS 65     /* The mem_sbrk heap, then the mmap arenas */
+#define MM_ANALYZE_SPANS  16     /* Equal spans of the heap of an arena */
+
+typedef struct {
+    int classes;                                 /* Size classes in the arrays */
+    unsigned long class_min[MM_STATS_CLASSES];   /* Least block size of a class */
+    unsigned long free_count[MM_STATS_CLASSES];  /* Free blocks per class */
+    unsigned long free_bytes[MM_STATS_CLASSES];
+    unsigned long alloc_count[MM_STATS_CLASSES]; /* Allocated heap blocks per class */
+    unsigned long alloc_bytes[MM_STATS_CLASSES];
+    unsigned long heap_bytes;      /* Bytes of all heap blocks */
+    unsigned long free_total;      /* Bytes of the free blocks */
+    unsigned long largest_free;    /* Largest free block */
+    unsigned long slab_bytes;      /* Slab blocks, also counted as allocated */
+    unsigned long slot_bytes;      /* Slots of them handed out */
+    struct {
+        unsigned long heap_bytes;  /* 0 if the arena has no heap */
+        unsigned long alloc_bytes;
+        unsigned long span_alloc[MM_ANALYZE_SPANS]; /* Allocated bytes per span */
+    } arena[MM_ANALYZE_ARENAS];
+} mm_analysis_t;
+
+/* Walk the heap into *an, returns 0 */
+extern int mm_analyze(mm_analysis_t *an);
+/* Print an analysis to f, with the fragmentation counters of STATS */
+extern void mm_analysis_print(FILE *f, const mm_analysis_t *an);
+
+/* Heap profile of mm.c built with -DPROFILE: mean bytes between samples,
+   and dump of the live samples in pprof format (-1 on error) */
+extern void mm_prof_set_rate(long bytes);
+extern int mm_prof_dump(const char *path);
@@ -0,0 +1,562 @@
+/*
+ * mmbench.c - Trace replay benchmark for the malloc packages
+ *
+ * Replays traces in the mdriver .rep format against whichever package
+ * (mm.c, mm-textbook.c or mm-naive.c) it is linked with, through the
+ * mm_malloc/mm_free/mm_realloc aliases of the DRIVER build. For every
+ * trace it reports
+ *  - throughput: operations per second, best of the repetitions
+ *  - latency: cycles per operation, 50th/90th/99th percentile and max,
+ *    over all operations of all repetitions
+ *  - peak utilization: the largest total payload live at any point,
+ *    divided by the heap size (mem_heap_hi - mem_heap_lo + 1) at the end
+ *    of the trace, as mdriver computes it
+ *  - moves: reallocs of a block that returned a new address (so the
+ *    data had to be copied), out of all reallocs of a block
+ * Results are printed as a table, or with -j as one JSON object per trace
+ * so they can be collected per commit.
+ *
+ * A .rep trace starts with four numbers (suggested heap size, number of
+ * ids, number of operations, weight), followed by one operation per line:
+ *  a <id> <size>   allocate
+ *  r <id> <size>   reallocate
+ *  f <id>          free
+ *
+ * Traces recorded by mm.c built with -DTRACE (see there for the format)
+ * are read too, and told apart by their "MMTRACE1" magic. Their records
+ * are merged by time across threads, and pointers become ids: a malloc,
+ * or a realloc that moves its block, takes the id of a freed block (the
+ * number of ids is the most blocks live at once); frees of blocks
+ * allocated before recording started are left out, realloc to 0 bytes is
+ * a free, and calls that returned NULL are left out.
+ *
+ * Usage: mmbench [-j] [-r reps] [-n name] trace.rep...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The packages are built with -DDRIVER, mm.h then declares mm_malloc etc. */
+#ifndef DRIVER
+#define DRIVER
+#endif
+#include "mm.h"
+#include "memlib.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define DEFAULT_REPS 5
+#define MMTRACE_MAGIC "MMTRACE1"   /* Start of a binary trace */
+#define UNZIG(v)      ((size_t) ((long long) ((v) >> 1) ^ -(long long) ((v) & 1)) << 3)
+
+/* One trace operation */
+typedef struct {
+    char type;     /* 'a', 'r' or 'f' */
+    int id;        /* Index of the block in the trace */
+    size_t size;   /* Payload bytes for 'a' and 'r' */
+} op_t;
+
+/* A trace loaded in memory */
+typedef struct {
+    const char *name;
+    int num_ids;
+    int num_ops;
+    op_t *ops;
+} trace_t;
+
+/* A record of a binary trace */
+typedef struct {
+    unsigned long long time;
+    size_t seq;         /* Position in the file: order of a thread's records */
+    int type;           /* 1 malloc, 2 free, 3 realloc */
+    size_t size;
+    size_t old, ptr;    /* Pointer freed or reallocated, pointer returned */
+} rec_t;
+
+/* Measurements of one trace */
+typedef struct {
+    double ops_per_sec;
+    unsigned long long cyc_p50, cyc_p90, cyc_p99, cyc_max;
+    size_t peak_payload;
+    size_t heap_size;
+    double util;
+    size_t reallocs, moves;
+} result_t;
+
+static int load_trace(const char *path, trace_t *t);
+static int load_mmtrace(FILE *f, const char *path, trace_t *t);
+static int decode(const unsigned char *buf, size_t len, rec_t **recs, size_t *n);
+static size_t find_slot(const size_t *keys, size_t mask, size_t p);
+static int cmp_rec(const void *a, const void *b);
+static int replay(trace_t *t, unsigned long long *cyc, result_t *r);
+static int run_trace(trace_t *t, int reps, result_t *r);
+static void print_result(const char *alloc, trace_t *t, result_t *r, int json);
+static double now(void);
+static int cmp_cycles(const void *a, const void *b);
+
+/*
+ * cycles - Cycle counter, or nanoseconds where there is none
+ */
+static inline unsigned long long cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int main(int argc, char **argv) {
+    const char *alloc = "mm";
+    int reps = DEFAULT_REPS;
+    int json = 0;
+    int c, i, status = 0;
+
+    while ((c = getopt(argc, argv, "jr:n:h")) != -1) {
+        switch (c) {
+        case 'j':
+            json = 1;
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'n':
+            alloc = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-j] [-r reps] [-n name] trace.rep...\n", argv[0]);
+            return (c == 'h') ? 0 : 2;
+        }
+    }
+    if (optind >= argc || reps < 1) {
+        fprintf(stderr, "usage: %s [-j] [-r reps] [-n name] trace.rep...\n", argv[0]);
+        return 2;
+    }
+
+    mem_init();
+    if (!json)
+        printf("%-12s %-24s %8s %12s %8s %8s %8s %10s %7s %15s\n", "alloc", "trace",
+            "ops", "ops/sec", "cyc p50", "cyc p90", "cyc p99", "cyc max", "util", "moves");
+
+    for (i = optind; i < argc; i++) {
+        trace_t t;
+        result_t r;
+        if (load_trace(argv[i], &t) < 0) {
+            status = 1;
+            continue;
+        }
+        if (run_trace(&t, reps, &r) < 0) {
+            fprintf(stderr, "%s: allocator failed on %s\n", alloc, t.name);
+            status = 1;
+        } else {
+            print_result(alloc, &t, &r, json);
+        }
+        free(t.ops);
+    }
+    return status;
+}
+
+/*
+ * load_trace - Read the .rep trace at path into t. Returns -1 on error
+ */
+static int load_trace(const char *path, trace_t *t) {
+    FILE *f = fopen(path, "r");
+    long heap_size, weight;
+    char type[2];
+    int n = 0;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, f) == 8 && memcmp(magic, MMTRACE_MAGIC, 8) == 0) {
+        n = load_mmtrace(f, path, t);
+        fclose(f);
+        return n;
+    }
+    rewind(f);
+    if (fscanf(f, "%ld %d %d %ld", &heap_size, &t->num_ids, &t->num_ops, &weight) != 4 ||
+        t->num_ids <= 0 || t->num_ops < 0) {
+        fprintf(stderr, "%s: bad trace header\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    t->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    t->ops = malloc((t->num_ops + 1) * sizeof(op_t));
+    if (t->ops == NULL) {
+        fclose(f);
+        return -1;
+    }
+
+    while (n < t->num_ops && fscanf(f, "%1s", type) == 1) {
+        op_t *op = &t->ops[n];
+        op->type = type[0];
+        op->size = 0;
+        if ((op->type == 'a' || op->type == 'r') ?
+            fscanf(f, "%d %zu", &op->id, &op->size) != 2 :
+            (op->type != 'f' || fscanf(f, "%d", &op->id) != 1)) {
+            fprintf(stderr, "%s: bad operation %d\n", path, n);
+            break;
+        }
+        if (op->id < 0 || op->id >= t->num_ids) {
+            fprintf(stderr, "%s: id %d out of range at operation %d\n", path, op->id, n);
+            break;
+        }
+        n++;
+    }
+    fclose(f);
+
+    if (n != t->num_ops) {
+        free(t->ops);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * load_mmtrace - Read the binary trace at path (f is past the magic) into
+ *                t. Returns -1 on error
+ */
+static int load_mmtrace(FILE *f, const char *path, trace_t *t) {
+    unsigned char *buf = NULL;
+    size_t len = 0, cap = 0, nrec = 0, i, k;
+    size_t *keys = NULL;         /* Pointer hash table: live pointer... */
+    int *vals = NULL;            /* ...and its id, -1 once freed */
+    int *ids = NULL;             /* Freed ids, to be reused */
+    int nfree = 0;
+    size_t mask;
+    rec_t *recs = NULL;
+    int ret = -1;
+
+    // Slurp the chunks
+    for (;;) {
+        if (len == cap) {
+            unsigned char *nb = realloc(buf, cap = cap ? 2 * cap : 1 << 20);
+            if (nb == NULL)
+                goto out;
+            buf = nb;
+        }
+        size_t got = fread(buf + len, 1, cap - len, f);
+        if (got == 0)
+            break;
+        len += got;
+    }
+    if (decode(buf, len, &recs, &nrec) < 0) {
+        fprintf(stderr, "%s: bad trace chunk\n", path);
+        goto out;
+    }
+    qsort(recs, nrec, sizeof(rec_t), cmp_rec);
+
+    for (mask = 1; mask < 2 * nrec; mask <<= 1)
+        ;
+    keys = calloc(mask, sizeof(size_t));
+    vals = malloc(mask * sizeof(int));
+    ids = malloc((nrec + 1) * sizeof(int));
+    t->ops = malloc((2 * nrec + 1) * sizeof(op_t));
+    if (keys == NULL || vals == NULL || ids == NULL || t->ops == NULL)
+        goto out;
+    mask--;
+
+    t->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    t->num_ids = 0;
+    t->num_ops = 0;
+    for (i = 0; i < nrec; i++) {
+        rec_t *rec = &recs[i];
+        size_t old = rec->type == 1 ? 0 : rec->old;
+        size_t ptr = rec->type == 2 || rec->size == 0 ? 0 : rec->ptr;
+        int id = -1;
+
+        if (rec->type != 2 && rec->size != 0 && rec->ptr == 0)
+            continue;  // Failed, nothing changed
+        // The live id of old, if it was recorded
+        if (old != 0) {
+            k = find_slot(keys, mask, old);
+            if (keys[k] == old && vals[k] >= 0) {
+                id = vals[k];
+                vals[k] = -1;
+            }
+        }
+        if (ptr == 0) {
+            // Free
+            if (id < 0)
+                continue;
+            t->ops[t->num_ops++] = (op_t) { 'f', id, 0 };
+            ids[nfree++] = id;
+            continue;
+        }
+        // The block is at ptr now, under its old id or a new one
+        k = find_slot(keys, mask, ptr);
+        if (keys[k] == ptr && vals[k] >= 0) {
+            // Its free was not recorded
+            t->ops[t->num_ops++] = (op_t) { 'f', vals[k], 0 };
+            ids[nfree++] = vals[k];
+        }
+        if (id >= 0) {
+            t->ops[t->num_ops++] = (op_t) { 'r', id, rec->size };
+        } else {
+            id = nfree > 0 ? ids[--nfree] : t->num_ids++;
+            t->ops[t->num_ops++] = (op_t) { 'a', id, rec->size };
+        }
+        keys[k] = ptr;
+        vals[k] = id;
+    }
+    if (t->num_ids == 0)
+        t->num_ids = 1;
+    ret = 0;
+
+out:
+    if (ret < 0) {
+        free(t->ops);
+        if (recs == NULL)
+            fprintf(stderr, "%s: out of memory\n", path);
+    }
+    free(buf);
+    free(recs);
+    free(keys);
+    free(vals);
+    free(ids);
+    return ret;
+}
+
+/*
+ * decode - Decode the chunks of buf into *recs, *n of them, with their
+ *          times made absolute. Returns -1 on a malformed chunk
+ */
+static int decode(const unsigned char *buf, size_t len, rec_t **recs, size_t *n) {
+    size_t pos = 0, cap = 0;
+    *recs = NULL;
+    *n = 0;
+
+    while (pos + 16 <= len) {
+        unsigned int clen;
+        unsigned long long time;
+        size_t last = 0;
+        memcpy(&clen, buf + pos + 4, 4);
+        memcpy(&time, buf + pos + 8, 8);
+        pos += 16;
+        if (clen > len - pos)
+            return -1;
+        const unsigned char *p = buf + pos, *end = p + clen;
+        pos += clen;
+
+        while (p < end) {
+            unsigned long long v[4];
+            int i, nv, type = *p++;
+            if (type < 1 || type > 3)
+                return -1;
+            // time delta, then old, size and ptr as the type has them
+            nv = type == 3 ? 4 : 3 - (type == 2);
+            for (i = 0; i < nv; i++) {
+                int shift = 0;
+                v[i] = 0;
+                do {
+                    if (p == end || shift > 63)
+                        return -1;
+                    v[i] |= (unsigned long long) (*p & 0x7f) << shift;
+                    shift += 7;
+                } while (*p++ & 0x80);
+            }
+            if (*n == cap) {
+                rec_t *nr = realloc(*recs, (cap = cap ? 2 * cap : 4096) * sizeof(rec_t));
+                if (nr == NULL)
+                    return -1;
+                *recs = nr;
+            }
+            rec_t *rec = &(*recs)[*n];
+            time += v[0];
+            rec->time = time;
+            rec->seq = (*n)++;
+            rec->type = type;
+            rec->old = rec->ptr = rec->size = 0;
+            // Pointers are zigzag distances from the last one, in 8 byte units
+            if (type != 1)
+                rec->old = last += UNZIG(v[1]);
+            if (type != 2) {
+                rec->size = v[nv - 2];
+                rec->ptr = last += UNZIG(v[nv - 1]);
+            }
+        }
+    }
+    return pos == len ? 0 : -1;
+}
+
+/*
+ * find_slot - Slot of pointer p in the open addressing table keys, or the
+ *             empty slot where it goes
+ */
+static size_t find_slot(const size_t *keys, size_t mask, size_t p) {
+    size_t k = ((p >> 4) * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+    while (keys[k] != 0 && keys[k] != p)
+        k = (k + 1) & mask;
+    return k;
+}
+
+/*
+ * replay - Run trace t once on a fresh heap, cycles of operation i go to
+ *          cyc[i], the largest live payload and the realloc counts to r.
+ *          Returns -1 if the allocator fails
+ */
+static int replay(trace_t *t, unsigned long long *cyc, result_t *r) {
+    void **ptrs = calloc(t->num_ids, sizeof(void*));
+    size_t *sizes = calloc(t->num_ids, sizeof(size_t));
+    size_t payload = 0, peak = 0, reallocs = 0, moves = 0;
+    unsigned long long start;
+    int i, ret = 0;
+
+    if (ptrs == NULL || sizes == NULL) {
+        free(ptrs);
+        free(sizes);
+        return -1;
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    for (i = 0; i < t->num_ops; i++) {
+        op_t *op = &t->ops[i];
+        void *p;
+
+        switch (op->type) {
+        case 'a':
+            start = cycles();
+            p = mm_malloc(op->size);
+            cyc[i] = cycles() - start;
+            if (p == NULL && op->size > 0) {
+                ret = -1;
+                goto out;
+            }
+            ptrs[op->id] = p;
+            sizes[op->id] = op->size;
+            payload += op->size;
+            break;
+        case 'r':
+            start = cycles();
+            p = mm_realloc(ptrs[op->id], op->size);
+            cyc[i] = cycles() - start;
+            if (p == NULL && op->size > 0) {
+                ret = -1;
+                goto out;
+            }
+            if (ptrs[op->id] != NULL && op->size > 0) {
+                reallocs++;
+                moves += (p != ptrs[op->id]);
+            }
+            ptrs[op->id] = p;
+            payload += op->size - sizes[op->id];
+            sizes[op->id] = op->size;
+            break;
+        default: /* 'f' */
+            start = cycles();
+            mm_free(ptrs[op->id]);
+            cyc[i] = cycles() - start;
+            ptrs[op->id] = NULL;
+            payload -= sizes[op->id];
+            sizes[op->id] = 0;
+            break;
+        }
+        if (payload > peak)
+            peak = payload;
+    }
+    r->peak_payload = peak;
+    r->reallocs = reallocs;
+    r->moves = moves;
+
+out:
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
+
+/*
+ * run_trace - Replay trace t reps times and fill in r. Returns -1 if the
+ *             allocator fails
+ */
+static int run_trace(trace_t *t, int reps, result_t *r) {
+    size_t n = (size_t) t->num_ops * reps;
+    unsigned long long *cyc = malloc((n + 1) * sizeof(unsigned long long));
+    double best = 0;
+    int i;
+
+    if (cyc == NULL)
+        return -1;
+
+    for (i = 0; i < reps; i++) {
+        double start = now();
+        if (replay(t, cyc + (size_t) i * t->num_ops, r) < 0) {
+            free(cyc);
+            return -1;
+        }
+        double secs = now() - start;
+        if (i == 0 || secs < best)
+            best = secs;
+    }
+
+    // The heap never shrinks: its size after the trace is its peak
+    r->heap_size = (size_t) ((char*) mem_heap_hi() - (char*) mem_heap_lo() + 1);
+    r->util = r->heap_size ? (double) r->peak_payload / r->heap_size : 0;
+    r->ops_per_sec = best > 0 ? t->num_ops / best : 0;
+
+    if (n == 0) {
+        r->cyc_p50 = r->cyc_p90 = r->cyc_p99 = r->cyc_max = 0;
+    } else {
+        qsort(cyc, n, sizeof(unsigned long long), cmp_cycles);
+        r->cyc_p50 = cyc[(n - 1) * 50 / 100];
+        r->cyc_p90 = cyc[(n - 1) * 90 / 100];
+        r->cyc_p99 = cyc[(n - 1) * 99 / 100];
+        r->cyc_max = cyc[n - 1];
+    }
+    free(cyc);
+    return 0;
+}
+
+/*
+ * print_result - One table row, or one JSON object per line with -j
+ */
+static void print_result(const char *alloc, trace_t *t, result_t *r, int json) {
+    if (json) {
+        printf("{\"alloc\":\"%s\",\"trace\":\"%s\",\"ops\":%d,\"ops_per_sec\":%.0f,"
+            "\"cyc_p50\":%llu,\"cyc_p90\":%llu,\"cyc_p99\":%llu,\"cyc_max\":%llu,"
+            "\"peak_payload\":%zu,\"heap_size\":%zu,\"util\":%.4f,"
+            "\"reallocs\":%zu,\"moves\":%zu}\n",
+            alloc, t->name, t->num_ops, r->ops_per_sec,
+            r->cyc_p50, r->cyc_p90, r->cyc_p99, r->cyc_max,
+            r->peak_payload, r->heap_size, r->util, r->reallocs, r->moves);
+    } else {
+        printf("%-12s %-24s %8d %12.0f %8llu %8llu %8llu %10llu %6.1f%% %7zu/%-7zu\n",
+            alloc, t->name, t->num_ops, r->ops_per_sec,
+            r->cyc_p50, r->cyc_p90, r->cyc_p99, r->cyc_max, 100 * r->util,
+            r->moves, r->reallocs);
+    }
+}
+
+/*
+ * now - Monotonic time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_rec(const void *a, const void *b) {
+    const rec_t *x = a, *y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int cmp_cycles(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long*) a;
+    unsigned long long y = *(const unsigned long long*) b;
+    return (x > y) - (x < y);
+}